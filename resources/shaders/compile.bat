@@ -1,5 +1,8 @@
 C:/VulkanSDK/1.1.77.0/Bin/glslangValidator.exe -V -o compiled/object.vert.spv object.vert
+C:/VulkanSDK/1.1.77.0/Bin/glslangValidator.exe -V -DCOMPACT_VERTEX -o compiled/object_compact.vert.spv object.vert
 C:/VulkanSDK/1.1.77.0/Bin/glslangValidator.exe -V -o compiled/object.frag.spv object.frag
 C:/VulkanSDK/1.1.77.0/Bin/glslangValidator.exe -V -o compiled/skybox.vert.spv skybox.vert
 C:/VulkanSDK/1.1.77.0/Bin/glslangValidator.exe -V -o compiled/skybox.frag.spv skybox.frag
+C:/VulkanSDK/1.1.77.0/Bin/glslangValidator.exe -V -o compiled/shadow.vert.spv shadow.vert
+C:/VulkanSDK/1.1.77.0/Bin/glslangValidator.exe -V -o compiled/mipmaps.comp.spv mipmaps.comp
 pause
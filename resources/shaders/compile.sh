@@ -1,5 +1,7 @@
 /Developer/VulkanSDK/macOS/Bin/glslangValidator -V -o compiled/object.vert.spv object.vert
+/Developer/VulkanSDK/macOS/Bin/glslangValidator -V -DCOMPACT_VERTEX -o compiled/object_compact.vert.spv object.vert
 /Developer/VulkanSDK/macOS/Bin/glslangValidator -V -o compiled/object.frag.spv object.frag
 /Developer/VulkanSDK/macOS/Bin/glslangValidator -V -o compiled/skybox.vert.spv skybox.vert
 /Developer/VulkanSDK/macOS/Bin/glslangValidator -V -o compiled/skybox.frag.spv skybox.frag
 /Developer/VulkanSDK/macOS/Bin/glslangValidator -V -o compiled/shadow.vert.spv shadow.vert
+/Developer/VulkanSDK/macOS/Bin/glslangValidator -V -o compiled/mipmaps.comp.spv mipmaps.comp
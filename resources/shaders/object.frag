@@ -43,8 +43,9 @@ void main() {
 	// Base color.
 	vec3 albedo = texture(colorMap, fragUv).rgb;
 	
-	// Compute normal in view space.
-	vec3 n = normalize(2.0 * texture(normalMap, fragUv).rgb - 1.0);
+	// Compute normal in view space, z is reconstructed from the two stored components.
+	vec2 nxy = 2.0 * texture(normalMap, fragUv).rg - 1.0;
+	vec3 n = normalize(vec3(nxy, sqrt(max(0.0, 1.0 - dot(nxy, nxy)))));
 	n = normalize(fragTbn * n);
 	// Light dir.
 	vec3 l = vec3(normalize(light.viewSpaceDir));
@@ -1,11 +1,20 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+#ifdef COMPACT_VERTEX
+// Compact vertex format: snorm position with the tangent frame handedness in w,
+// octahedral normal and tangent, half float UV.
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNormal;
+layout(location = 2) in vec2 inTangent;
+layout(location = 4) in vec2 inTexCoord;
+#else
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec3 inTangent;
 layout(location = 3) in vec3 inBitangent;
 layout(location = 4) in vec2 inTexCoord;
+#endif
 
 layout(binding = 0) uniform CameraInfos {
     mat4 view;
@@ -32,20 +41,41 @@ out gl_PerVertex {
 	vec4 gl_Position;
 };
 
+#ifdef COMPACT_VERTEX
+vec3 decodeOctahedral(vec2 e){
+	vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if(v.z < 0.0){
+		v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return normalize(v);
+}
+#endif
+
 void main() {
 	
 	mat4 modelView = cam.view * object.model;
 	mat3 normalMat = transpose(inverse(mat3(modelView)));
-	vec3 T = normalize(normalMat * inTangent);
-	vec3 B = normalize(normalMat * inBitangent);
-	vec3 N = normalize(normalMat * inNormal);
+#ifdef COMPACT_VERTEX
+	vec3 position = inPosition.xyz;
+	vec3 normal = decodeOctahedral(inNormal);
+	vec3 tangent = decodeOctahedral(inTangent);
+	vec3 bitangent = inPosition.w * cross(normal, tangent);
+#else
+	vec3 position = inPosition;
+	vec3 normal = inNormal;
+	vec3 tangent = inTangent;
+	vec3 bitangent = inBitangent;
+#endif
+	vec3 T = normalize(normalMat * tangent);
+	vec3 B = normalize(normalMat * bitangent);
+	vec3 N = normalize(normalMat * normal);
 	
-	vec4 viewSpacePos = modelView * vec4(inPosition, 1.0);
+	vec4 viewSpacePos = modelView * vec4(position, 1.0);
 	fragViewSpacePos = viewSpacePos.xyz;
 	fragUv = inTexCoord;
 	fragTbn = mat3(T, B, N);
 	
-	fragLightSpacePos = light.viewproj * object.model * vec4(inPosition, 1.0);
+	fragLightSpacePos = light.viewproj * object.model * vec4(position, 1.0);
 	
 	gl_Position = cam.proj * viewSpacePos;
 	
@@ -1,11 +1,8 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Only the position is used, so that any vertex format can be bound.
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNormal;
-layout(location = 2) in vec3 inTangent;
-layout(location = 3) in vec3 inBitangent;
-layout(location = 4) in vec2 inTexCoord;
 
 layout(binding = 0) uniform CameraInfos {
     mat4 view;
@@ -0,0 +1,79 @@
+#include "Defragmenter.hpp"
+#include "VulkanUtilities.hpp"
+
+void Defragmenter::init(const VkDevice & device, const uint32_t count){
+	_device = device;
+	_count = std::max(count, 1u);
+}
+
+void Defragmenter::begin(){
+	// The frame using a retired buffer was submitted _count frames ago, its fence has been waited on.
+	for(size_t rid = 0; rid < _retired.size();){
+		if(_retired[rid].frame + _count > _frame){
+			++rid;
+			continue;
+		}
+		vkDestroyBuffer(_device, _retired[rid].buffer, nullptr);
+		MemoryAllocator::free(_retired[rid].memory);
+		_retired[rid] = _retired.back();
+		_retired.pop_back();
+	}
+	if(_budget > 0){
+		MemoryAllocator::evacuate();
+	}
+	_remaining = _budget;
+	++_frame;
+}
+
+bool Defragmenter::consume(const VkDeviceSize size){
+	if(_budget == 0){
+		return false;
+	}
+	if(size > _remaining){
+		// Let a resource larger than the budget move alone.
+		if(_remaining < _budget){
+			_remaining = 0;
+			return false;
+		}
+	}
+	_remaining -= std::min(size, _remaining);
+	_movedSize += size;
+	return true;
+}
+
+void Defragmenter::relocate(VkCommandBuffer & commandBuffer, VkBuffer & buffer, MemoryAllocator::Allocation & memory, const VkDeviceSize size, const VkBufferUsageFlags usage, const VkPipelineStageFlags stages, const VkAccessFlags access){
+	if(!MemoryAllocator::evacuating(memory) || !consume(memory.size)){
+		return;
+	}
+	VkBuffer newBuffer;
+	MemoryAllocator::Allocation newMemory;
+	VulkanUtilities::createBuffer(_device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, newBuffer, newMemory);
+	MemoryAllocator::setMovable(newMemory);
+	// The old buffer is only read, by the previous frames and the copy.
+	VkBufferCopy copyRegion = {};
+	copyRegion.srcOffset = 0;
+	copyRegion.dstOffset = 0;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(commandBuffer, buffer, newBuffer, 1, &copyRegion);
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = newBuffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = access;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, stages, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	_retired.push_back({ buffer, memory, _frame });
+	buffer = newBuffer;
+	memory = newMemory;
+}
+
+void Defragmenter::clean(){
+	for(Retired & retired : _retired){
+		vkDestroyBuffer(_device, retired.buffer, nullptr);
+		MemoryAllocator::free(retired.memory);
+	}
+	_retired.clear();
+}
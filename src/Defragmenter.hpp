@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.hpp"
+#include "MemoryAllocator.hpp"
+#include <vector>
+
+/// Incremental compaction of the device memory blocks. Each frame, the allocator can pick a sparse block to evacuate,
+/// and the owners of the resources it holds copy them to new locations, within a budget of bytes moved per frame.
+/// The block is released once all its resources have been moved and the frames in flight are done with them.
+class Defragmenter {
+public:
+
+	/// The number of frames in flight bounds the lifetime of the replaced buffers.
+	void init(const VkDevice & device, const uint32_t count);
+
+	/// Start a frame: destroy the buffers that can't be used anymore, pick blocks to evacuate and reset the budget.
+	void begin();
+
+	/// Take some of the frame budget to move a resource, false if it is exhausted.
+	bool consume(const VkDeviceSize size);
+
+	/// Move a device local buffer of the given size out of an evacuated block if the budget allows it, recording the copy in a command buffer.
+	/// The handles are replaced, the old buffer is kept while the frames in flight can use it.
+	void relocate(VkCommandBuffer & commandBuffer, VkBuffer & buffer, MemoryAllocator::Allocation & memory, const VkDeviceSize size, const VkBufferUsageFlags usage, const VkPipelineStageFlags stages, const VkAccessFlags access);
+
+	/// Bytes moved each frame at most.
+	void budget(const VkDeviceSize budget){ _budget = budget; }
+
+	/// Bytes moved since the start.
+	VkDeviceSize movedSize() const { return _movedSize; }
+
+	void clean();
+
+private:
+
+	/// Buffer replaced by a relocation.
+	struct Retired {
+		VkBuffer buffer;
+		MemoryAllocator::Allocation memory;
+		uint64_t frame;
+	};
+
+	VkDevice _device = VK_NULL_HANDLE;
+	uint32_t _count = 1;
+	uint64_t _frame = 0;
+
+	std::vector<Retired> _retired;
+
+	VkDeviceSize _budget = VkDeviceSize(1) << 20;
+	VkDeviceSize _remaining = 0;
+	VkDeviceSize _movedSize = 0;
+};
@@ -0,0 +1,59 @@
+#include "Frustum.hpp"
+
+Frustum::Frustum(const glm::mat4 & matrix){
+	const glm::vec4 row0(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]);
+	const glm::vec4 row1(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]);
+	const glm::vec4 row2(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2]);
+	const glm::vec4 row3(matrix[0][3], matrix[1][3], matrix[2][3], matrix[3][3]);
+	_planes[0] = row3 + row0; // Left.
+	_planes[1] = row3 - row0; // Right.
+	_planes[2] = row3 + row1; // Bottom.
+	_planes[3] = row3 - row1; // Top.
+	_planes[4] = row2; // Near.
+	_planes[5] = row3 - row2; // Far.
+	// Normalize so that distances are in the same unit as the positions.
+	for(auto & plane : _planes){
+		plane /= glm::length(glm::vec3(plane));
+	}
+	for(size_t pid = 0; pid < 8; ++pid){
+		const glm::vec4 plane = pid < _planes.size() ? _planes[pid] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		_planesX[pid] = plane.x;
+		_planesY[pid] = plane.y;
+		_planesZ[pid] = plane.z;
+		_planesW[pid] = plane.w;
+	}
+}
+
+bool Frustum::intersects(const glm::vec3 & center, const float radius) const {
+	for(const auto & plane : _planes){
+		if(glm::dot(glm::vec3(plane), center) + plane.w < -radius){
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Frustum::intersects(const glm::vec3 & center, const glm::vec3 & extent) const {
+	// The box is outside if it is behind one of the planes: the signed distance of its center is below its projected radius.
+#ifdef DRAGON_SSE
+	const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+	const __m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	int outside = 0;
+	for(size_t pid = 0; pid < 8; pid += 4){
+		const __m128 px = _mm_load_ps(_planesX + pid), py = _mm_load_ps(_planesY + pid), pz = _mm_load_ps(_planesZ + pid);
+		const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)), _mm_add_ps(_mm_mul_ps(pz, cz), _mm_load_ps(_planesW + pid)));
+		const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, px), ex), _mm_mul_ps(_mm_andnot_ps(signMask, py), ey)), _mm_mul_ps(_mm_andnot_ps(signMask, pz), ez));
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+	}
+	return outside == 0;
+#else
+	for(const auto & plane : _planes){
+		const float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+		if(glm::dot(glm::vec3(plane), center) + plane.w + radius < 0.0f){
+			return false;
+		}
+	}
+	return true;
+#endif
+}
@@ -0,0 +1,31 @@
+#ifndef Frustum_h
+#define Frustum_h
+
+#include "common.hpp"
+#include <array>
+
+/// Planes of a view frustum, normals pointing inside, in the space the matrix transforms from.
+class Frustum {
+	
+public:
+	
+	/// Extract the planes of a (view)projection matrix with a [0,1] depth range.
+	Frustum(const glm::mat4 & matrix);
+	
+	/// Is the sphere at least partially inside the frustum.
+	bool intersects(const glm::vec3 & center, const float radius) const;
+	
+	/// Is the axis-aligned box, given by its center and half size, at least partially inside the frustum.
+	bool intersects(const glm::vec3 & center, const glm::vec3 & extent) const;
+	
+private:
+	
+	std::array<glm::vec4, 6> _planes;
+	// Coordinates of the planes, padded to two groups of four with planes containing everything.
+	alignas(16) float _planesX[8];
+	alignas(16) float _planesY[8];
+	alignas(16) float _planesZ[8];
+	alignas(16) float _planesW[8];
+};
+
+#endif
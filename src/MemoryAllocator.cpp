@@ -0,0 +1,437 @@
+#include "MemoryAllocator.hpp"
+#include "VulkanUtilities.hpp"
+
+#include <algorithm>
+
+VkPhysicalDevice MemoryAllocator::_physicalDevice = VK_NULL_HANDLE;
+VkDevice MemoryAllocator::_device = VK_NULL_HANDLE;
+VkDeviceSize MemoryAllocator::_blockSize = MemoryAllocator::defaultBlockSize;
+VkDeviceSize MemoryAllocator::_granularity = 1;
+VkPhysicalDeviceMemoryProperties MemoryAllocator::_memoryProperties = {};
+std::vector<MemoryAllocator::Pool> MemoryAllocator::_pools;
+uint32_t MemoryAllocator::_allocationsCount = 0;
+std::mutex MemoryAllocator::_mutex;
+
+// Index of the lowest set bit of a non-zero mask.
+static uint32_t lowestBit(const uint64_t mask){
+	uint32_t bit = 0;
+	while(((mask >> bit) & 1) == 0){
+		++bit;
+	}
+	return bit;
+}
+
+// Index of the highest set bit of a non-zero mask.
+static uint32_t highestBit(const uint64_t mask){
+	uint32_t bit = 63;
+	while(((mask >> bit) & 1) == 0){
+		--bit;
+	}
+	return bit;
+}
+
+MemoryAllocator::Pool::Pool(){
+	for(uint32_t fl = 0; fl < firstLevelCount; ++fl){
+		for(uint32_t sl = 0; sl < secondLevelCount; ++sl){
+			heads[fl][sl] = -1;
+		}
+	}
+}
+
+void MemoryAllocator::init(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkDeviceSize blockSize){
+	_physicalDevice = physicalDevice;
+	_device = device;
+	_blockSize = blockSize;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+	_granularity = properties.limits.bufferImageGranularity;
+	vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &_memoryProperties);
+	// Two pools per memory type, for linear and optimal resources.
+	_pools.clear();
+	_pools.resize(2 * _memoryProperties.memoryTypeCount);
+	for(uint32_t pid = 0; pid < _pools.size(); ++pid){
+		_pools[pid].type = pid / 2;
+	}
+	_allocationsCount = 0;
+}
+
+VkDeviceSize MemoryAllocator::blockSize(const uint32_t type){
+	// Don't use more than an eighth of a small heap for each block.
+	const VkDeviceSize heapSize = _memoryProperties.memoryHeaps[_memoryProperties.memoryTypes[type].heapIndex].size;
+	return std::max(std::min(_blockSize, heapSize / 8), VkDeviceSize(1) << 20);
+}
+
+void MemoryAllocator::mapping(const VkDeviceSize size, uint32_t & firstLevel, uint32_t & secondLevel){
+	firstLevel = 0;
+	for(VkDeviceSize s = size; s > 1; s >>= 1){
+		++firstLevel;
+	}
+	// Linear subdivision of [2^fl, 2^(fl+1)), small sizes get exact classes.
+	secondLevel = uint32_t(((size << secondLevelBits) >> firstLevel) - secondLevelCount);
+}
+
+int MemoryAllocator::createNode(Pool & pool){
+	if(!pool.unusedNodes.empty()){
+		const int node = pool.unusedNodes.back();
+		pool.unusedNodes.pop_back();
+		pool.nodes[node] = Node();
+		return node;
+	}
+	pool.nodes.emplace_back();
+	return int(pool.nodes.size()) - 1;
+}
+
+void MemoryAllocator::releaseNode(Pool & pool, const int node){
+	pool.unusedNodes.push_back(node);
+}
+
+void MemoryAllocator::insertFree(Pool & pool, const int node){
+	uint32_t fl, sl;
+	mapping(pool.nodes[node].size, fl, sl);
+	Node & current = pool.nodes[node];
+	current.free = true;
+	current.prevFree = -1;
+	if(pool.blocks[current.block].evacuating){
+		current.nextFree = -1;
+		return;
+	}
+	current.nextFree = pool.heads[fl][sl];
+	if(current.nextFree >= 0){
+		pool.nodes[current.nextFree].prevFree = node;
+	}
+	pool.heads[fl][sl] = node;
+	pool.secondLevelBitmaps[fl] |= (1u << sl);
+	pool.firstLevelBitmap |= (uint64_t(1) << fl);
+}
+
+void MemoryAllocator::removeFree(Pool & pool, const int node){
+	uint32_t fl, sl;
+	mapping(pool.nodes[node].size, fl, sl);
+	Node & current = pool.nodes[node];
+	if(pool.blocks[current.block].evacuating){
+		current.free = false;
+		return;
+	}
+	if(current.prevFree >= 0){
+		pool.nodes[current.prevFree].nextFree = current.nextFree;
+	} else {
+		pool.heads[fl][sl] = current.nextFree;
+	}
+	if(current.nextFree >= 0){
+		pool.nodes[current.nextFree].prevFree = current.prevFree;
+	}
+	current.prevFree = -1;
+	current.nextFree = -1;
+	current.free = false;
+	if(pool.heads[fl][sl] < 0){
+		pool.secondLevelBitmaps[fl] &= ~(1u << sl);
+		if(pool.secondLevelBitmaps[fl] == 0){
+			pool.firstLevelBitmap &= ~(uint64_t(1) << fl);
+		}
+	}
+}
+
+int MemoryAllocator::findFree(Pool & pool, const VkDeviceSize size){
+	uint32_t fl, sl;
+	mapping(size, fl, sl);
+	// Round up to the next class, so that any node found is large enough.
+	if(fl > secondLevelBits){
+		mapping(size + (VkDeviceSize(1) << (fl - secondLevelBits)) - 1, fl, sl);
+	}
+	if(fl >= firstLevelCount){
+		return -1;
+	}
+	uint32_t secondMask = pool.secondLevelBitmaps[fl] & (~0u << sl);
+	if(secondMask == 0){
+		const uint64_t firstMask = (fl + 1 < firstLevelCount) ? (pool.firstLevelBitmap & (~uint64_t(0) << (fl + 1))) : 0;
+		if(firstMask == 0){
+			return -1;
+		}
+		fl = lowestBit(firstMask);
+		secondMask = pool.secondLevelBitmaps[fl];
+	}
+	sl = lowestBit(secondMask);
+	return pool.heads[fl][sl];
+}
+
+int MemoryAllocator::createBlock(Pool & pool, const VkDeviceSize size, const bool dedicated){
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = pool.type;
+	Block block;
+	if(vkAllocateMemory(_device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS){
+		std::cerr << "Unable to allocate device memory block." << std::endl;
+		return -1;
+	}
+	block.size = size;
+	block.dedicated = dedicated;
+	if(_memoryProperties.memoryTypes[pool.type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT){
+		void * data = nullptr;
+		if(vkMapMemory(_device, block.memory, 0, size, 0, &data) != VK_SUCCESS){
+			std::cerr << "Unable to map device memory block." << std::endl;
+		}
+		block.data = static_cast<char *>(data);
+	}
+	// Reuse the slot of a released block.
+	int index = -1;
+	for(size_t bid = 0; bid < pool.blocks.size(); ++bid){
+		if(pool.blocks[bid].memory == VK_NULL_HANDLE){
+			index = int(bid);
+			break;
+		}
+	}
+	if(index < 0){
+		pool.blocks.push_back(block);
+		index = int(pool.blocks.size()) - 1;
+	} else {
+		pool.blocks[index] = block;
+	}
+	const int node = createNode(pool);
+	pool.nodes[node].block = uint32_t(index);
+	pool.nodes[node].size = size;
+	pool.blocks[index].firstNode = node;
+	if(!dedicated){
+		insertFree(pool, node);
+	}
+	return index;
+}
+
+void MemoryAllocator::destroyBlock(Pool & pool, const uint32_t block){
+	if(pool.blocks[block].data){
+		vkUnmapMemory(_device, pool.blocks[block].memory);
+	}
+	vkFreeMemory(_device, pool.blocks[block].memory, nullptr);
+	pool.blocks[block] = Block();
+}
+
+void MemoryAllocator::split(Pool & pool, const int node, const VkDeviceSize size){
+	const int remainder = createNode(pool);
+	Node & current = pool.nodes[node];
+	Node & next = pool.nodes[remainder];
+	next.block = current.block;
+	next.offset = current.offset + size;
+	next.size = current.size - size;
+	next.prevPhysical = node;
+	next.nextPhysical = current.nextPhysical;
+	if(next.nextPhysical >= 0){
+		pool.nodes[next.nextPhysical].prevPhysical = remainder;
+	}
+	current.nextPhysical = remainder;
+	current.size = size;
+	insertFree(pool, remainder);
+}
+
+MemoryAllocator::Allocation MemoryAllocator::allocate(const VkMemoryRequirements & requirements, const VkMemoryPropertyFlags properties, const bool optimal){
+	std::lock_guard<std::mutex> lock(_mutex);
+	Allocation allocation;
+	const uint32_t type = VulkanUtilities::findMemoryType(requirements.memoryTypeBits, properties, _physicalDevice);
+	// Linear and optimal resources can only share a block if there is no granularity constraint.
+	allocation.pool = 2 * type + ((optimal && _granularity > 1) ? 1 : 0);
+	Pool & pool = _pools[allocation.pool];
+	const VkDeviceSize size = std::max(requirements.size, VkDeviceSize(1));
+	const VkDeviceSize alignment = std::max(requirements.alignment, VkDeviceSize(1));
+	int node = -1;
+	if(size > blockSize(type) / 2){
+		// Large resources get their own memory.
+		const int block = createBlock(pool, size, true);
+		if(block < 0){
+			return allocation;
+		}
+		node = pool.blocks[block].firstNode;
+	} else {
+		// Enough space for any placement of the aligned range.
+		node = findFree(pool, size + alignment - 1);
+		if(node < 0){
+			if(createBlock(pool, blockSize(type), false) < 0){
+				return allocation;
+			}
+			node = findFree(pool, size + alignment - 1);
+		}
+		removeFree(pool, node);
+		const VkDeviceSize padding = (alignment - pool.nodes[node].offset % alignment) % alignment;
+		if(padding > 0){
+			// The padding stays free, its previous neighbour is used.
+			split(pool, node, padding);
+			const int aligned = pool.nodes[node].nextPhysical;
+			insertFree(pool, node);
+			removeFree(pool, aligned);
+			node = aligned;
+		}
+		if(pool.nodes[node].size > size){
+			split(pool, node, size);
+		}
+	}
+	const Node & current = pool.nodes[node];
+	const Block & block = pool.blocks[current.block];
+	allocation.memory = block.memory;
+	allocation.offset = current.offset;
+	allocation.size = size;
+	allocation.data = block.data ? block.data + current.offset : nullptr;
+	allocation.node = uint32_t(node);
+	pool.blocks[current.block].allocations += 1;
+	pool.blocks[current.block].pinned += 1;
+	pool.blocks[current.block].used += size;
+	++_allocationsCount;
+	return allocation;
+}
+
+void MemoryAllocator::free(Allocation & allocation){
+	if(allocation.memory == VK_NULL_HANDLE){
+		return;
+	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	Pool & pool = _pools[allocation.pool];
+	int node = int(allocation.node);
+	const uint32_t block = pool.nodes[node].block;
+	pool.blocks[block].allocations -= 1;
+	pool.blocks[block].pinned -= pool.nodes[node].movable ? 0 : 1;
+	pool.blocks[block].used -= pool.nodes[node].size;
+	pool.nodes[node].movable = false;
+	--_allocationsCount;
+	allocation = Allocation();
+	if(pool.blocks[block].dedicated){
+		releaseNode(pool, node);
+		destroyBlock(pool, block);
+		return;
+	}
+	// Merge with the free neighbours.
+	const int prev = pool.nodes[node].prevPhysical;
+	if(prev >= 0 && pool.nodes[prev].free){
+		removeFree(pool, prev);
+		pool.nodes[prev].size += pool.nodes[node].size;
+		pool.nodes[prev].nextPhysical = pool.nodes[node].nextPhysical;
+		if(pool.nodes[prev].nextPhysical >= 0){
+			pool.nodes[pool.nodes[prev].nextPhysical].prevPhysical = prev;
+		}
+		releaseNode(pool, node);
+		node = prev;
+	}
+	const int next = pool.nodes[node].nextPhysical;
+	if(next >= 0 && pool.nodes[next].free){
+		removeFree(pool, next);
+		pool.nodes[node].size += pool.nodes[next].size;
+		pool.nodes[node].nextPhysical = pool.nodes[next].nextPhysical;
+		if(pool.nodes[node].nextPhysical >= 0){
+			pool.nodes[pool.nodes[node].nextPhysical].prevPhysical = node;
+		}
+		releaseNode(pool, next);
+	}
+	insertFree(pool, node);
+	if(pool.blocks[block].allocations > 0){
+		return;
+	}
+	// Release an empty block if it was evacuated or if it is not the last one of the pool.
+	bool release = pool.blocks[block].evacuating;
+	for(uint32_t bid = 0; bid < pool.blocks.size() && !release; ++bid){
+		release = bid != block && pool.blocks[bid].memory != VK_NULL_HANDLE && !pool.blocks[bid].dedicated;
+	}
+	if(release){
+		removeFree(pool, node);
+		releaseNode(pool, node);
+		destroyBlock(pool, block);
+	}
+}
+
+void MemoryAllocator::setMovable(const Allocation & allocation){
+	if(allocation.memory == VK_NULL_HANDLE){
+		return;
+	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	Pool & pool = _pools[allocation.pool];
+	Node & node = pool.nodes[allocation.node];
+	if(!node.movable){
+		node.movable = true;
+		pool.blocks[node.block].pinned -= 1;
+	}
+}
+
+void MemoryAllocator::evacuate(){
+	std::lock_guard<std::mutex> lock(_mutex);
+	for(Pool & pool : _pools){
+		// One block at a time per pool, the sparsest one with only movable resources.
+		bool busy = false;
+		VkDeviceSize freeSize = 0;
+		int candidate = -1;
+		for(uint32_t bid = 0; bid < pool.blocks.size(); ++bid){
+			const Block & block = pool.blocks[bid];
+			if(block.memory == VK_NULL_HANDLE || block.dedicated){
+				continue;
+			}
+			if(block.evacuating){
+				busy = true;
+				break;
+			}
+			freeSize += block.size - block.used;
+			if(block.pinned == 0 && block.used > 0 && block.used <= block.size / 2 && (candidate < 0 || block.used < pool.blocks[candidate].used)){
+				candidate = int(bid);
+			}
+		}
+		if(busy || candidate < 0){
+			continue;
+		}
+		// Don't create new blocks to receive the moved resources.
+		const Block & block = pool.blocks[candidate];
+		if(freeSize - (block.size - block.used) < block.used){
+			continue;
+		}
+		for(int node = block.firstNode; node >= 0; node = pool.nodes[node].nextPhysical){
+			if(pool.nodes[node].free){
+				removeFree(pool, node);
+				pool.nodes[node].free = true;
+			}
+		}
+		pool.blocks[candidate].evacuating = true;
+	}
+}
+
+bool MemoryAllocator::evacuating(const Allocation & allocation){
+	if(allocation.memory == VK_NULL_HANDLE){
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	const Pool & pool = _pools[allocation.pool];
+	return pool.blocks[pool.nodes[allocation.node].block].evacuating;
+}
+
+MemoryAllocator::Statistics MemoryAllocator::statistics(){
+	std::lock_guard<std::mutex> lock(_mutex);
+	Statistics statistics;
+	statistics.allocations = _allocationsCount;
+	for(const Pool & pool : _pools){
+		for(const Block & block : pool.blocks){
+			if(block.memory == VK_NULL_HANDLE){
+				continue;
+			}
+			++statistics.blocks;
+			statistics.size += block.size;
+			if(!block.dedicated && !block.evacuating){
+				statistics.freeSize += block.size - block.used;
+			}
+		}
+		// The largest free range is in the highest non empty size class.
+		if(pool.firstLevelBitmap != 0){
+			const uint32_t fl = highestBit(pool.firstLevelBitmap);
+			const uint32_t sl = highestBit(pool.secondLevelBitmaps[fl]);
+			for(int node = pool.heads[fl][sl]; node >= 0; node = pool.nodes[node].nextFree){
+				statistics.largestFree = std::max(statistics.largestFree, pool.nodes[node].size);
+			}
+		}
+	}
+	return statistics;
+}
+
+void MemoryAllocator::clean(){
+	std::lock_guard<std::mutex> lock(_mutex);
+	if(_allocationsCount > 0){
+		std::cerr << "Device memory still in use: " << _allocationsCount << " allocations." << std::endl;
+	}
+	for(Pool & pool : _pools){
+		for(uint32_t bid = 0; bid < pool.blocks.size(); ++bid){
+			if(pool.blocks[bid].memory != VK_NULL_HANDLE){
+				destroyBlock(pool, bid);
+			}
+		}
+	}
+	_pools.clear();
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "common.hpp"
+#include <vector>
+#include <mutex>
+
+/// Device memory sub-allocator: buffers and images are placed in large blocks, one set of blocks per memory type,
+/// instead of each getting its own vkAllocateMemory. Free ranges of a block are kept in physical order and merged
+/// when released, and indexed by size in two-level segregated lists (TLSF) for a constant time good fit search.
+/// Linear and optimal resources are kept in separate blocks when the device bufferImageGranularity requires it.
+/// Host visible blocks are persistently mapped. Allocations can be made from any thread.
+/// Blocks can be compacted over several frames: the sparsest block holding only movable resources is evacuated,
+/// new allocations go elsewhere, and it is released once its owners have moved their resources.
+class MemoryAllocator {
+public:
+
+	/// Default size of the blocks, reduced for small heaps.
+	static const VkDeviceSize defaultBlockSize = VkDeviceSize(64) << 20;
+
+	/// A sub-allocation: the range [offset, offset+size) of memory.
+	struct Allocation {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		// Start of the range for host visible memory, null otherwise.
+		char * data = nullptr;
+		uint32_t pool = 0;
+		uint32_t node = 0;
+	};
+
+	static void init(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkDeviceSize blockSize = defaultBlockSize);
+
+	/// Allocate memory with the given properties for a resource, optimal is true for images with optimal tiling.
+	static Allocation allocate(const VkMemoryRequirements & requirements, const VkMemoryPropertyFlags properties, const bool optimal);
+
+	/// Release an allocation, the resource bound to it must have been destroyed. The handle is reset.
+	static void free(Allocation & allocation);
+
+	/// Flag an allocation whose owner can move the resource when its block is evacuated.
+	static void setMovable(const Allocation & allocation);
+
+	/// Pick a block to evacuate in each pool without one, if it is sparse and the other blocks have room for its resources.
+	static void evacuate();
+
+	/// Is the allocation in a block being evacuated, its resource should be moved.
+	static bool evacuating(const Allocation & allocation);
+
+	/// Memory usage, free space is counted in shared blocks only.
+	struct Statistics {
+		uint32_t blocks = 0;
+		uint32_t allocations = 0;
+		VkDeviceSize size = 0;
+		VkDeviceSize freeSize = 0;
+		// Largest free range available for new allocations.
+		VkDeviceSize largestFree = 0;
+	};
+
+	static Statistics statistics();
+
+	/// Release all blocks, every allocation must have been freed.
+	static void clean();
+
+private:
+
+	/// Size classes: two-level index, the first on the power of two, the second splitting it linearly.
+	static const uint32_t secondLevelBits = 3;
+	static const uint32_t secondLevelCount = 1 << secondLevelBits;
+	static const uint32_t firstLevelCount = 64;
+
+	/// Device memory object, split in nodes.
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		char * data = nullptr;
+		uint32_t allocations = 0;
+		// Allocations whose resource can't be moved.
+		uint32_t pinned = 0;
+		VkDeviceSize used = 0;
+		int firstNode = -1;
+		// Large allocations get a block of their own, never shared.
+		bool dedicated = false;
+		// Free ranges of an evacuated block are not listed anymore.
+		bool evacuating = false;
+	};
+
+	/// Range of a block, free or used, linked to its physical neighbours and, when free, to the other ranges of its size class.
+	struct Node {
+		uint32_t block = 0;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		int prevPhysical = -1;
+		int nextPhysical = -1;
+		int prevFree = -1;
+		int nextFree = -1;
+		bool free = false;
+		bool movable = false;
+	};
+
+	/// Blocks of a memory type, for linear or optimal resources.
+	struct Pool {
+		Pool();
+		uint32_t type = 0;
+		std::vector<Block> blocks;
+		std::vector<Node> nodes;
+		std::vector<int> unusedNodes;
+		uint64_t firstLevelBitmap = 0;
+		uint32_t secondLevelBitmaps[firstLevelCount] = {};
+		int heads[firstLevelCount][secondLevelCount];
+	};
+
+	/// Size of the shared blocks of a memory type.
+	static VkDeviceSize blockSize(const uint32_t type);
+
+	static void mapping(const VkDeviceSize size, uint32_t & firstLevel, uint32_t & secondLevel);
+
+	static int createNode(Pool & pool);
+
+	static void releaseNode(Pool & pool, const int node);
+
+	static void insertFree(Pool & pool, const int node);
+
+	static void removeFree(Pool & pool, const int node);
+
+	/// Free node of at least the given size, or -1.
+	static int findFree(Pool & pool, const VkDeviceSize size);
+
+	/// Allocate a device memory object in the pool, returns the block index or -1.
+	static int createBlock(Pool & pool, const VkDeviceSize size, const bool dedicated);
+
+	static void destroyBlock(Pool & pool, const uint32_t block);
+
+	/// Split a used node at the given offset from its start, the remainder becomes a free node.
+	static void split(Pool & pool, const int node, const VkDeviceSize size);
+
+	static VkPhysicalDevice _physicalDevice;
+	static VkDevice _device;
+	static VkDeviceSize _blockSize;
+	static VkDeviceSize _granularity;
+	static VkPhysicalDeviceMemoryProperties _memoryProperties;
+	static std::vector<Pool> _pools;
+	static uint32_t _allocationsCount;
+	static std::mutex _mutex;
+};
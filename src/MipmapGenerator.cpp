@@ -0,0 +1,229 @@
+#include "MipmapGenerator.hpp"
+#include "VulkanUtilities.hpp"
+#include "PipelineUtilities.hpp"
+
+#include <array>
+
+/// Push constants of the compute shader.
+struct MipmapInfos {
+	int32_t width;
+	int32_t height;
+	int32_t levelsCount;
+	int32_t srgb;
+};
+
+// Counters of finished groups for each layer of an image, spaced by the largest storage buffer offset alignment allowed.
+static const VkDeviceSize countersStride = 256;
+
+MipmapGenerator::MipmapGenerator(const VkDevice & device){
+	// All levels as storage images, and the counters buffer.
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[0].descriptorCount = maxLevels;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+	if(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &_descriptorSetLayout) != VK_SUCCESS) {
+		std::cerr << "Unable to create mipmaps descriptor." << std::endl;
+		return;
+	}
+	PipelineUtilities::createComputePipeline(device, "mipmaps", _descriptorSetLayout, sizeof(MipmapInfos), _pipelineLayout, _pipeline);
+	if(_pipeline == VK_NULL_HANDLE){
+		// The compute shader is compiled by compile.sh.
+		std::cerr << "Unable to load the mipmaps compute shader, mipmaps will be generated with blits." << std::endl;
+	}
+}
+
+void MipmapGenerator::add(const VkImage & image, const VkFormat format, const uint32_t width, const uint32_t height, const bool cube, const uint32_t mipCount, const bool storage, const bool srgb){
+	_pending.push_back({ image, format, width, height, cube, mipCount, storage, srgb });
+}
+
+void MipmapGenerator::flush(const VkPhysicalDevice & physicalDevice, const VkDevice & device, UploadContext & upload){
+	if(_pending.empty()){
+		return;
+	}
+	std::vector<Pending> computed;
+	std::vector<Pending> blitted;
+	for(const Pending & pending : _pending){
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(physicalDevice, pending.format, &formatProperties);
+		const bool supported = pending.storage && (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+		if(_pipeline != VK_NULL_HANDLE && supported && pending.mipCount <= maxLevels){
+			computed.push_back(pending);
+		} else {
+			blitted.push_back(pending);
+		}
+	}
+	_pending.clear();
+
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkBuffer countersBuffer = VK_NULL_HANDLE;
+	MemoryAllocator::Allocation countersMemory;
+	std::vector<VkImageView> views;
+	std::vector<VkDescriptorSet> descriptorSets(computed.size());
+	const uint32_t imagesCount = static_cast<uint32_t>(computed.size());
+	if(!computed.empty()){
+		// Resources living until the uploads are complete.
+		std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+		poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		poolSizes[0].descriptorCount = imagesCount * maxLevels;
+		poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		poolSizes[1].descriptorCount = imagesCount;
+		VkDescriptorPoolCreateInfo poolInfo = {};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+		poolInfo.pPoolSizes = poolSizes.data();
+		poolInfo.maxSets = imagesCount;
+		if(vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+			std::cerr << "Unable to create mipmaps descriptor pool." << std::endl;
+		}
+		VulkanUtilities::createBuffer(device, countersStride * imagesCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, countersBuffer, countersMemory);
+
+		std::vector<VkDescriptorSetLayout> layouts(imagesCount, _descriptorSetLayout);
+		VkDescriptorSetAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		allocInfo.descriptorPool = descriptorPool;
+		allocInfo.descriptorSetCount = imagesCount;
+		allocInfo.pSetLayouts = layouts.data();
+		if(vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+			std::cerr << "Unable to create mipmaps descriptor sets." << std::endl;
+		}
+		// One view per level, covering all layers. Levels past the end of the chain reuse the last view, they are never written.
+		for(uint32_t iid = 0; iid < imagesCount; ++iid){
+			const Pending & pending = computed[iid];
+			std::array<VkDescriptorImageInfo, maxLevels> imageInfos = {};
+			for(uint32_t lid = 0; lid < pending.mipCount; ++lid){
+				VkImageViewCreateInfo viewInfo = {};
+				viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+				viewInfo.image = pending.image;
+				viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+				viewInfo.format = pending.format;
+				viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				viewInfo.subresourceRange.baseMipLevel = lid;
+				viewInfo.subresourceRange.levelCount = 1;
+				viewInfo.subresourceRange.baseArrayLayer = 0;
+				viewInfo.subresourceRange.layerCount = pending.cube ? 6 : 1;
+				VkImageView view;
+				if(vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS) {
+					std::cerr << "Unable to create mipmap view." << std::endl;
+				}
+				views.push_back(view);
+			}
+			for(uint32_t lid = 0; lid < maxLevels; ++lid){
+				imageInfos[lid].imageView = views[views.size() - pending.mipCount + std::min(lid, pending.mipCount - 1)];
+				imageInfos[lid].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+			}
+			VkDescriptorBufferInfo bufferInfo = {};
+			bufferInfo.buffer = countersBuffer;
+			bufferInfo.offset = countersStride * iid;
+			bufferInfo.range = countersStride;
+
+			std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+			descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[0].dstSet = descriptorSets[iid];
+			descriptorWrites[0].dstBinding = 0;
+			descriptorWrites[0].dstArrayElement = 0;
+			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			descriptorWrites[0].descriptorCount = maxLevels;
+			descriptorWrites[0].pImageInfo = imageInfos.data();
+			descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[1].dstSet = descriptorSets[iid];
+			descriptorWrites[1].dstBinding = 1;
+			descriptorWrites[1].dstArrayElement = 0;
+			descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[1].descriptorCount = 1;
+			descriptorWrites[1].pBufferInfo = &bufferInfo;
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+		}
+	}
+
+	VkCommandBuffer & commandBuffer = upload.graphicsCommandBuffer();
+	for(Pending & pending : blitted){
+		VulkanUtilities::generateMipmaps(commandBuffer, pending.image, pending.width, pending.height, pending.cube, pending.mipCount, pending.format, physicalDevice);
+	}
+	if(!computed.empty()){
+		// Reset the counters, and make all levels writable from the compute shader.
+		vkCmdFillBuffer(commandBuffer, countersBuffer, 0, VK_WHOLE_SIZE, 0);
+		VkBufferMemoryBarrier bufferBarrier = {};
+		bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		bufferBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.buffer = countersBuffer;
+		bufferBarrier.offset = 0;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		std::vector<VkImageMemoryBarrier> barriers(imagesCount);
+		for(uint32_t iid = 0; iid < imagesCount; ++iid){
+			VkImageMemoryBarrier & barrier = barriers[iid];
+			barrier = {};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.image = computed[iid].image;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			barrier.subresourceRange.baseMipLevel = 0;
+			barrier.subresourceRange.levelCount = computed[iid].mipCount;
+			barrier.subresourceRange.baseArrayLayer = 0;
+			barrier.subresourceRange.layerCount = computed[iid].cube ? 6 : 1;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &bufferBarrier, imagesCount, barriers.data());
+
+		// One dispatch per image, with a group per 64x64 tile of each layer. Images are independent, no barrier between them.
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+		for(uint32_t iid = 0; iid < imagesCount; ++iid){
+			const Pending & pending = computed[iid];
+			const MipmapInfos infos = { int32_t(pending.width), int32_t(pending.height), int32_t(pending.mipCount), pending.srgb ? 1 : 0 };
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1, &descriptorSets[iid], 0, nullptr);
+			vkCmdPushConstants(commandBuffer, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MipmapInfos), &infos);
+			vkCmdDispatch(commandBuffer, (pending.width + 63) / 64, (pending.height + 63) / 64, pending.cube ? 6 : 1);
+		}
+
+		// Optimize the layout of all levels for sampling.
+		for(VkImageMemoryBarrier & barrier : barriers){
+			barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		}
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, imagesCount, barriers.data());
+	}
+	// Submitted with the other uploads.
+	_views.insert(_views.end(), views.begin(), views.end());
+	if(descriptorPool != VK_NULL_HANDLE){
+		_descriptorPools.push_back(descriptorPool);
+	}
+	if(countersBuffer != VK_NULL_HANDLE){
+		_countersBuffers.emplace_back(countersBuffer, countersMemory);
+	}
+}
+
+void MipmapGenerator::clean(const VkDevice & device){
+	for(VkImageView & view : _views){
+		vkDestroyImageView(device, view, nullptr);
+	}
+	for(VkDescriptorPool & pool : _descriptorPools){
+		vkDestroyDescriptorPool(device, pool, nullptr);
+	}
+	for(auto & buffer : _countersBuffers){
+		vkDestroyBuffer(device, buffer.first, nullptr);
+		MemoryAllocator::free(buffer.second);
+	}
+	_views.clear();
+	_descriptorPools.clear();
+	_countersBuffers.clear();
+	vkDestroyPipeline(device, _pipeline, nullptr);
+	vkDestroyPipelineLayout(device, _pipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(device, _descriptorSetLayout, nullptr);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.hpp"
+#include "UploadContext.hpp"
+
+/// Generate the mip levels of textures created at runtime on the GPU. Images are queued once their level 0 is copied,
+/// and all the pending ones are processed in a single batch of uploads, with one compute dispatch per image.
+class MipmapGenerator {
+public:
+
+	/// Levels handled by the compute shader (4096x4096 textures), larger images fall back to blits.
+	static const uint32_t maxLevels = 13;
+
+	MipmapGenerator(const VkDevice & device);
+
+	/// Queue an image whose levels are all in the transfer destination layout, level 0 being filled.
+	/// Images created with storage usage are processed by the compute shader, other ones with blits.
+	void add(const VkImage & image, const VkFormat format, const uint32_t width, const uint32_t height, const bool cube, const uint32_t mipCount, const bool storage, const bool srgb);
+
+	/// Record the generation of the levels of the queued images and their transition for sampling in fragment shaders.
+	void flush(const VkPhysicalDevice & physicalDevice, const VkDevice & device, UploadContext & upload);
+
+	/// Release the generator and the resources used by the flushes, once the uploads are complete.
+	void clean(const VkDevice & device);
+
+private:
+
+	struct Pending {
+		VkImage image;
+		VkFormat format;
+		uint32_t width;
+		uint32_t height;
+		bool cube;
+		uint32_t mipCount;
+		bool storage;
+		bool srgb;
+	};
+
+	std::vector<Pending> _pending;
+	
+	// Resources used by the recorded dispatches.
+	std::vector<VkDescriptorPool> _descriptorPools;
+	std::vector<std::pair<VkBuffer, MemoryAllocator::Allocation>> _countersBuffers;
+	std::vector<VkImageView> _views;
+
+	VkDescriptorSetLayout _descriptorSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout _pipelineLayout = VK_NULL_HANDLE;
+	VkPipeline _pipeline = VK_NULL_HANDLE;
+};
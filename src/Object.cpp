@@ -10,48 +10,204 @@
 #include "VulkanUtilities.hpp"
 #include "resources/Resources.hpp"
 
+#include <array>
+#include <limits>
+
 VkDescriptorSetLayout Object::descriptorSetLayout = VK_NULL_HANDLE;
 
 Object::~Object() {  }
 
-Object::Object(const std::string &name, const float shininess) {
+Object::Object(const std::string &name, const float shininess, const bool castShadows, const bool receiveShadows) {
 	_name = name;
+	_castShadows = castShadows;
+	_receiveShadows = receiveShadows;
 	infos.model = glm::mat4(1.0f);
 	infos.shininess = shininess;
 }
 
-void Object::upload(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue) {
+void Object::load(const MeshUtilities::VertexFormat format, const bool compressedTextures) {
+	
+	/// Textures.
+	const std::string colorPath = "resources/textures/" + _name + "_texture_color.png";
+	const std::string normalPath = "resources/textures/" + _name + "_texture_normal.png";
+	// Cooked with their full mip chains on first use then read from their KTX2 files, block compressed when supported.
+	_colorCache = std::make_shared<TextureCache>(colorPath, compressedTextures ? TextureUtilities::BC1 : TextureUtilities::RGBA8, false);
+	_normalCache = std::make_shared<TextureCache>(normalPath, compressedTextures ? TextureUtilities::BC5 : TextureUtilities::RGBA8, true);
+	if(!_colorCache->valid()){ std::cerr << "Error loading color image." << std::endl; }
+	if(!_normalCache->valid()){ std::cerr << "Error loading normal image." << std::endl; }
 	
-	// Mesh.
-	Mesh mesh;
-	const std::string meshPath = "resources/meshes/" + _name + ".obj";
-	MeshUtilities::loadObj(meshPath, mesh, MeshUtilities::Indexed);
-	MeshUtilities::centerAndUnitMesh(mesh);
-	MeshUtilities::computeTangentsAndBinormals(mesh);
+	// Mesh, processed on first use then read from its binary cache.
+	_mesh = std::make_shared<MeshCache>("resources/meshes/" + _name + ".obj");
+	const MeshCache & mesh = *_mesh;
+	// Without geometry, the object is never drawn.
+	if(!mesh.valid()){
+		std::cerr << "Error loading mesh." << std::endl;
+		return;
+	}
+	
+	// Depth-only passes read a separate stream of tightly packed positions.
+	if(format == MeshUtilities::Compact){
+		MeshUtilities::compressVertices(mesh.vertices(), mesh.verticesCount(), _compactVertices);
+		_positions.resize(sizeof(glm::i16vec4) * _compactVertices.size());
+		glm::i16vec4 * positions = reinterpret_cast<glm::i16vec4 *>(_positions.data());
+		for(size_t vid = 0; vid < _compactVertices.size(); ++vid){
+			positions[vid] = _compactVertices[vid].pos;
+		}
+	} else {
+		_positions.resize(sizeof(glm::vec3) * mesh.verticesCount());
+		glm::vec3 * positions = reinterpret_cast<glm::vec3 *>(_positions.data());
+		for(size_t vid = 0; vid < mesh.verticesCount(); ++vid){
+			positions[vid] = mesh.vertices()[vid].pos;
+		}
+	}
+	
+	for(uint32_t lid = 0; lid < mesh.lodsCount(); ++lid){
+		_lods.push_back(mesh.lod(lid));
+	}
+	_indices.assign(mesh.indices(), mesh.indices() + mesh.lod(0).indicesCount);
+	_meshlets.assign(mesh.meshlets(), mesh.meshlets() + mesh.meshletsCount());
+	_bboxMin = mesh.bboxMin();
+	_bboxMax = mesh.bboxMax();
+	_center = 0.5f * (_bboxMin + _bboxMax);
+	_radius = 0.5f * glm::length(_bboxMax - _bboxMin);
+}
+
+void Object::upload(const VkDevice & device, UploadContext & upload, TextureStreamer & textures) {
+	const MeshCache & mesh = *_mesh;
 	
 	/// Buffers.
-	VulkanUtilities::setupBuffers(physicalDevice, device, commandPool, graphicsQueue, mesh, _vertexBuffer, _vertexBufferMemory, _indexBuffer, _indexBufferMemory);
+	if(mesh.valid()){
+		if(!_compactVertices.empty()){
+			VulkanUtilities::setupBuffers(device, upload, _compactVertices.data(), sizeof(CompactVertex) * _compactVertices.size(), mesh.indices(), mesh.indicesCount(), _vertexBuffer, _vertexBufferMemory, _indexBuffer, _indexBufferMemory);
+		} else {
+			VulkanUtilities::setupBuffers(device, upload, mesh.vertices(), sizeof(Vertex) * mesh.verticesCount(), mesh.indices(), mesh.indicesCount(), _vertexBuffer, _vertexBufferMemory, _indexBuffer, _indexBufferMemory);
+		}
+		VulkanUtilities::setupBuffer(device, upload, _positions.data(), _positions.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, _positionBuffer, _positionBufferMemory);
+		_vertexBufferSize = _compactVertices.empty() ? sizeof(Vertex) * mesh.verticesCount() : sizeof(CompactVertex) * _compactVertices.size();
+		_positionBufferSize = _positions.size();
+		_indexBufferSize = sizeof(uint32_t) * mesh.indicesCount();
+		// The geometry can be moved when defragmenting.
+		MemoryAllocator::setMovable(_vertexBufferMemory);
+		MemoryAllocator::setMovable(_positionBufferMemory);
+		MemoryAllocator::setMovable(_indexBufferMemory);
+	}
 	
-	_count  = static_cast<uint32_t>(mesh.indices.size());
+	/// Textures, only their coarsest levels for now.
+	_colorTexture = textures.add(_colorCache, upload);
+	_normalTexture = textures.add(_normalCache, upload);
 	
-	/// Textures.
-	unsigned int texWidth, texHeight, texChannels;
-	void* image;
-	int rett = Resources::loadImage("resources/textures/" + _name + "_texture_color.png", texWidth, texHeight, texChannels, &image, true);
-	if(rett != 0){ std::cerr << "Error loading color image." << std::endl; }
-	VulkanUtilities::createTexture(image, texWidth, texHeight, false, MAX_MIPMAP_LEVELS, physicalDevice, device, commandPool, graphicsQueue, _textureColorImage, _textureColorMemory, _textureColorView);
-	free(image);
-	
-	rett = Resources::loadImage("resources/textures/" + _name + "_texture_normal.png", texWidth, texHeight, texChannels, &image, true);
-	if(rett != 0){ std::cerr << "Error loading normal image." << std::endl; }
-	VulkanUtilities::createTexture(image, texWidth, texHeight, false, MAX_MIPMAP_LEVELS, physicalDevice, device, commandPool, graphicsQueue, _textureNormalImage, _textureNormalMemory, _textureNormalView);
-	free(image);
+	// Release the CPU copies, the streamer keeps the texture caches.
+	_colorCache.reset();
+	_normalCache.reset();
+	_mesh.reset();
+	std::vector<CompactVertex>().swap(_compactVertices);
+	std::vector<char>().swap(_positions);
+}
+
+float Object::pixelsPerUnit(const glm::mat4 & view, const glm::mat4 & projection, const float height) const {
+	// At the nearest point of the bounding sphere for perspective projections.
+	const float scale = std::max(glm::length(glm::vec3(infos.model[0])), std::max(glm::length(glm::vec3(infos.model[1])), glm::length(glm::vec3(infos.model[2]))));
+	const float pixels = 0.5f * height * std::abs(projection[1][1]);
+	if(projection[2][3] != 0.0f){
+		const float depth = -(view * infos.model * glm::vec4(_center, 1.0f)).z - _radius * scale;
+		if(depth <= 0.0f){
+			return std::numeric_limits<float>::infinity();
+		}
+		return pixels / depth;
+	}
+	return pixels;
+}
+
+float Object::screenSize(const glm::mat4 & view, const glm::mat4 & projection, const float height) const {
+	const float scale = std::max(glm::length(glm::vec3(infos.model[0])), std::max(glm::length(glm::vec3(infos.model[1])), glm::length(glm::vec3(infos.model[2]))));
+	return 2.0f * _radius * scale * pixelsPerUnit(view, projection, height);
+}
+
+const MeshCache::Lod & Object::lod(const glm::mat4 & view, const glm::mat4 & projection, const float height, const float threshold) const {
+	// Without geometry, nothing is drawn.
+	static const MeshCache::Lod empty = { 0, 0, 0.0f };
+	if(_lods.empty()){
+		return empty;
+	}
+	const float scale = std::max(glm::length(glm::vec3(infos.model[0])), std::max(glm::length(glm::vec3(infos.model[1])), glm::length(glm::vec3(infos.model[2]))));
+	const float pixels = pixelsPerUnit(view, projection, height);
+	if(std::isinf(pixels)){
+		return _lods[0];
+	}
+	for(size_t lid = _lods.size() - 1; lid > 0; --lid){
+		if(_lods[lid].error * scale * pixels <= threshold){
+			return _lods[lid];
+		}
+	}
+	return _lods[0];
+}
+
+void Object::createCulledIndexBuffers(const VkDevice & device, const uint32_t count, const uint32_t slots){
+	// A single meshlet is culled with the object.
+	if(_meshlets.size() < 2){
+		return;
+	}
+	_culledIndexBuffers.resize(count);
+	_culledIndexBuffersMemory.resize(count);
+	const VkDeviceSize size = sizeof(uint32_t) * _indices.size() * slots;
+	for(uint32_t i = 0; i < count; ++i){
+		VulkanUtilities::createBuffer(device, size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _culledIndexBuffers[i], _culledIndexBuffersMemory[i]);
+	}
+}
+
+bool Object::visible(const Frustum & frustum) const {
+	// World space box enclosing the transformed one.
+	glm::vec3 center, extent;
+	bounds(glm::mat4(1.0f), center, extent);
+	return frustum.intersects(center, extent);
+}
+
+void Object::bounds(const glm::mat4 & transform, glm::vec3 & center, glm::vec3 & extent) const {
+	const glm::mat4 model = transform * infos.model;
+	center = glm::vec3(model * glm::vec4(0.5f * (_bboxMin + _bboxMax), 1.0f));
+	const glm::vec3 localExtent = 0.5f * (_bboxMax - _bboxMin);
+	const glm::mat3 frame(model);
+	extent = glm::abs(frame[0]) * localExtent.x + glm::abs(frame[1]) * localExtent.y + glm::abs(frame[2]) * localExtent.z;
+}
+
+uint32_t Object::cullMeshlets(const uint32_t frame, const uint32_t slot, const glm::mat4 & viewproj, const glm::vec4 & viewer) const {
+	// Test in model space, the model matrix is expected to have a uniform scale.
+	const Frustum frustum(viewproj * infos.model);
+	glm::vec4 localViewer = glm::inverse(infos.model) * viewer;
+	if(viewer.w == 0.0f){
+		localViewer = glm::vec4(glm::normalize(glm::vec3(localViewer)), 0.0f);
+	}
+	
+	const VkDeviceSize slotSize = sizeof(uint32_t) * _indices.size();
+	uint32_t * const indices = reinterpret_cast<uint32_t*>(_culledIndexBuffersMemory[frame].data + slot * slotSize);
+	uint32_t count = 0;
+	for(const Meshlet & meshlet : _meshlets){
+		if(!frustum.intersects(meshlet.center, meshlet.radius)){
+			continue;
+		}
+		// Backface culling of the whole normal cone.
+		if(viewer.w == 0.0f){
+			if(glm::dot(-glm::vec3(localViewer), meshlet.coneAxis) >= meshlet.coneCutoff){
+				continue;
+			}
+		} else {
+			const glm::vec3 direction = meshlet.center - glm::vec3(localViewer);
+			if(glm::dot(direction, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(direction) + meshlet.radius){
+				continue;
+			}
+		}
+		memcpy(indices + count, &_indices[meshlet.firstIndex], sizeof(uint32_t) * meshlet.indicesCount);
+		count += meshlet.indicesCount;
+	}
+	return count;
 }
 
 void Object::generateDescriptorSets(const VkDevice & device, const VkDescriptorSetLayout & shadowLayout, const VkDescriptorPool & pool, const std::vector<VkBuffer> & constants, const std::vector<VkImageView> & shadowMaps, int count){
 	
 	_descriptorSets.resize(count);
 	_shadowDescriptorSets.resize(count);
+	_colorViews.assign(count, _colorTexture->view());
+	_normalViews.assign(count, _normalTexture->view());
 	
 	for (size_t i = 0; i < _descriptorSets.size(); i++) {
 		VkDescriptorSetAllocateInfo allocInfo = {};
@@ -76,11 +232,11 @@ void Object::generateDescriptorSets(const VkDevice & device, const VkDescriptorS
 		
 		VkDescriptorImageInfo imageInfo = {};
 		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = _textureColorView;
+		imageInfo.imageView = _colorViews[i];
 		
 		VkDescriptorImageInfo imageNormalInfo = {};
 		imageNormalInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageNormalInfo.imageView = _textureNormalView;
+		imageNormalInfo.imageView = _normalViews[i];
 		
 		VkDescriptorImageInfo imageShadowInfo = {};
 		imageShadowInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
@@ -158,18 +314,49 @@ void Object::generateDescriptorSets(const VkDevice & device, const VkDescriptorS
 	
 }
 
+void Object::updateDescriptorSets(const VkDevice & device, const uint32_t i){
+	const std::array<VkImageView, 2> views = {{ _colorTexture->view(), _normalTexture->view() }};
+	if(views[0] == _colorViews[i] && views[1] == _normalViews[i]){
+		return;
+	}
+	_colorViews[i] = views[0];
+	_normalViews[i] = views[1];
+	// Color and normal maps, at bindings 1 and 2.
+	std::array<VkDescriptorImageInfo, 2> imageInfos = {};
+	std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+	for(uint32_t tid = 0; tid < 2; ++tid){
+		imageInfos[tid].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		imageInfos[tid].imageView = views[tid];
+		descriptorWrites[tid].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[tid].dstSet = _descriptorSets[i];
+		descriptorWrites[tid].dstBinding = tid + 1;
+		descriptorWrites[tid].dstArrayElement = 0;
+		descriptorWrites[tid].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[tid].descriptorCount = 1;
+		descriptorWrites[tid].pImageInfo = &imageInfos[tid];
+	}
+	vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+void Object::defragment(VkCommandBuffer & commandBuffer, Defragmenter & defragmenter){
+	defragmenter.relocate(commandBuffer, _vertexBuffer, _vertexBufferMemory, _vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	defragmenter.relocate(commandBuffer, _positionBuffer, _positionBufferMemory, _positionBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	defragmenter.relocate(commandBuffer, _indexBuffer, _indexBufferMemory, _indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+}
+
 void Object::clean(VkDevice & device){
-	vkDestroyImageView(device, _textureColorView, nullptr);
-	vkDestroyImage(device, _textureColorImage, nullptr);
-	vkFreeMemory(device, _textureColorMemory, nullptr);
-	vkDestroyImageView(device, _textureNormalView, nullptr);
-	vkDestroyImage(device, _textureNormalImage, nullptr);
-	vkFreeMemory(device, _textureNormalMemory, nullptr);
+	// Textures are owned by the streamer.
 	
 	vkDestroyBuffer(device, _vertexBuffer, nullptr);
-	vkFreeMemory(device, _vertexBufferMemory, nullptr);
+	MemoryAllocator::free(_vertexBufferMemory);
+	vkDestroyBuffer(device, _positionBuffer, nullptr);
+	MemoryAllocator::free(_positionBufferMemory);
 	vkDestroyBuffer(device, _indexBuffer, nullptr);
-	vkFreeMemory(device, _indexBufferMemory, nullptr);
+	MemoryAllocator::free(_indexBufferMemory);
+	for(size_t i = 0; i < _culledIndexBuffers.size(); ++i){
+		vkDestroyBuffer(device, _culledIndexBuffers[i], nullptr);
+		MemoryAllocator::free(_culledIndexBuffersMemory[i]);
+	}
 }
 
 VkDescriptorSetLayout Object::createDescriptorSetLayout(const VkDevice & device, const VkSampler & sampler, const VkSampler & shadowSampler){
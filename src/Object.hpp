@@ -11,45 +11,108 @@
 
 #include "common.hpp"
 #include "resources/MeshUtilities.hpp"
+#include "resources/MeshCache.hpp"
+#include "resources/TextureCache.hpp"
+#include "Frustum.hpp"
+#include "TextureStreamer.hpp"
+#include "UploadContext.hpp"
+#include "Defragmenter.hpp"
 
 class Object {
 public:
 	
-	Object(const std::string & name, const float shininess);
+	Object(const std::string & name, const float shininess, const bool castShadows = true, const bool receiveShadows = true);
 	
 	~Object();
 	
-	void upload(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue);
+	/// Load the mesh and the textures on the CPU, can be called from any thread.
+	/// Textures are block compressed if supported, else decoded from their PNG.
+	void load(const MeshUtilities::VertexFormat format, const bool compressedTextures);
+	
+	/// Create the GPU buffers from the loaded data, then release it. Textures are handed to the streamer.
+	void upload(const VkDevice & device, UploadContext & upload, TextureStreamer & textures);
+	
+	/// Create the per frame index buffers receiving the visible meshlets, with one slot per pass.
+	void createCulledIndexBuffers(const VkDevice & device, const uint32_t count, const uint32_t slots);
+
+	/// Move the geometry buffers out of the memory blocks being evacuated, within the defragmenter budget.
+	void defragment(VkCommandBuffer & commandBuffer, Defragmenter & defragmenter);
 
 	void clean(VkDevice & device);
 	
 	void generateDescriptorSets(const VkDevice & device, const VkDescriptorSetLayout & shadowLayout, const VkDescriptorPool & pool, const std::vector<VkBuffer> & constants, const std::vector<VkImageView> & shadowMaps, const int count);
 	
-	const VkDescriptorSet & descriptorSet(const int i){ return _descriptorSets[i]; }
+	/// Point the descriptor set of a frame to the current views of the streamed textures, if they changed.
+	void updateDescriptorSets(const VkDevice & device, const uint32_t i);
+	
+	const VkDescriptorSet & descriptorSet(const int i) const { return _descriptorSets[i]; }
 	const VkDescriptorSet & shadowDescriptorSet(const int i) const { return _shadowDescriptorSets[i]; }
 	
-	VkBuffer _vertexBuffer;
-	VkBuffer _indexBuffer;
-	uint32_t _count;
+	/// Coarsest level of detail whose error, projected with the given matrices on a viewport of the given height, stays under the threshold in pixels. Empty if the mesh failed to load.
+	const MeshCache::Lod & lod(const glm::mat4 & view, const glm::mat4 & projection, const float height, const float threshold) const;
+	
+	/// Diameter of the bounding sphere once projected with the given matrices on a viewport of the given height, in pixels.
+	float screenSize(const glm::mat4 & view, const glm::mat4 & projection, const float height) const;
+	
+	/// Is the bounding box of the object, once transformed, at least partially inside the world space frustum.
+	bool visible(const Frustum & frustum) const;
+	
+	/// Center and half size of the box enclosing the bounding box of the object, transformed by the model then the given matrix.
+	void bounds(const glm::mat4 & transform, glm::vec3 & center, glm::vec3 & extent) const;
+	
+	/// Write the indices of the meshlets inside the frustum and facing the viewer in a slot of the frame culled index buffer.
+	/// The viewer is a position (w = 1) or a direction towards an infinitely far viewer (w = 0). Returns the number of indices written.
+	uint32_t cullMeshlets(const uint32_t frame, const uint32_t slot, const glm::mat4 & viewproj, const glm::vec4 & viewer) const;
+	
+	VkBuffer _vertexBuffer = VK_NULL_HANDLE;
+	VkBuffer _positionBuffer = VK_NULL_HANDLE;
+	VkBuffer _indexBuffer = VK_NULL_HANDLE;
+	std::vector<MeshCache::Lod> _lods;
+	std::vector<Meshlet> _meshlets;
+	std::vector<VkBuffer> _culledIndexBuffers;
+	// Bounding box and sphere in model space.
+	glm::vec3 _bboxMin = glm::vec3(0.0f);
+	glm::vec3 _bboxMax = glm::vec3(0.0f);
+	glm::vec3 _center = glm::vec3(0.0f);
+	float _radius = 0.0f;
+	// Shadow map participation: casters are rendered in the shadow pass, receivers bound the casters kept.
+	bool _castShadows;
+	bool _receiveShadows;
 	ObjectInfos infos;
+	// Streamed textures, their views change as levels are loaded.
+	std::shared_ptr<TextureStreamer::Texture> _colorTexture;
+	std::shared_ptr<TextureStreamer::Texture> _normalTexture;
 	
 	static VkDescriptorSetLayout createDescriptorSetLayout(const VkDevice & device, const VkSampler & sampler, const VkSampler & shadowSampler);
 	static VkDescriptorSetLayout descriptorSetLayout;
 	
 private:
-	std::string _name;
 	
+	/// Size of a world unit in pixels at the nearest point of the bounding sphere, infinite if the viewer is inside it.
+	float pixelsPerUnit(const glm::mat4 & view, const glm::mat4 & projection, const float height) const;
+	
+	std::string _name;
 	
-	VkImage _textureColorImage;
-	VkImage _textureNormalImage;
-	VkImageView _textureColorView;
-	VkImageView _textureNormalView;
+	// CPU data prepared by load(), released by upload().
+	std::shared_ptr<MeshCache> _mesh;
+	std::vector<CompactVertex> _compactVertices;
+	std::vector<char> _positions;
+	std::shared_ptr<TextureCache> _colorCache;
+	std::shared_ptr<TextureCache> _normalCache;
 	
-	VkDeviceMemory _vertexBufferMemory;
-	VkDeviceMemory _indexBufferMemory;
-	VkDeviceMemory _textureColorMemory;
-	VkDeviceMemory _textureNormalMemory;
+	MemoryAllocator::Allocation _vertexBufferMemory;
+	MemoryAllocator::Allocation _positionBufferMemory;
+	MemoryAllocator::Allocation _indexBufferMemory;
+	VkDeviceSize _vertexBufferSize = 0;
+	VkDeviceSize _positionBufferSize = 0;
+	VkDeviceSize _indexBufferSize = 0;
+	std::vector<MemoryAllocator::Allocation> _culledIndexBuffersMemory;
+	// Full resolution indices, for meshlets culling.
+	std::vector<uint32_t> _indices;
 	std::vector<VkDescriptorSet> _descriptorSets;
+	// Texture views written in each descriptor set.
+	std::vector<VkImageView> _colorViews;
+	std::vector<VkImageView> _normalViews;
 	std::vector<VkDescriptorSet> _shadowDescriptorSets;
 };
 
@@ -9,11 +9,20 @@
 #include "PipelineUtilities.hpp"
 #include "VulkanUtilities.hpp"
 
-void PipelineUtilities::createPipeline(const VkDevice & device, const std::string & moduleName, const VkRenderPass & renderPass,const VkDescriptorSetLayout & descriptorSetLayout, const uint32_t width, const uint32_t height, const bool vertexOnly, const VkCullModeFlags cullMode, const bool depthTest, const bool depthWrite, const bool depthBias, const VkCompareOp compareOp, const int pushSize, VkPipelineLayout & pipelineLayout, VkPipeline & pipeline){
+void PipelineUtilities::createPipeline(const VkDevice & device, const std::string & vertexModuleName, const std::string & fragmentModuleName, const VertexLayout & vertexLayout, const VkRenderPass & renderPass,const VkDescriptorSetLayout & descriptorSetLayout, const uint32_t width, const uint32_t height, const VkCullModeFlags cullMode, const bool depthTest, const bool depthWrite, const bool depthBias, const VkCompareOp compareOp, const int pushSize, VkPipelineLayout & pipelineLayout, VkPipeline & pipeline){
 	// This is independent from the RTs.
+	const bool vertexOnly = fragmentModuleName.empty();
 	/// Shaders.
-	VkShaderModule vertShaderModule = VulkanUtilities::createShaderModule(device, "resources/shaders/compiled/" + moduleName+ ".vert.spv");
-	VkShaderModule fragShaderModule = {};
+	pipeline = VK_NULL_HANDLE;
+	pipelineLayout = VK_NULL_HANDLE;
+	VkShaderModule vertShaderModule = VulkanUtilities::createShaderModule(device, "resources/shaders/compiled/" + vertexModuleName + ".vert.spv");
+	VkShaderModule fragShaderModule = vertexOnly ? VK_NULL_HANDLE : VulkanUtilities::createShaderModule(device, "resources/shaders/compiled/" + fragmentModuleName + ".frag.spv");
+	if(vertShaderModule == VK_NULL_HANDLE || (!vertexOnly && fragShaderModule == VK_NULL_HANDLE)){
+		std::cerr << "Unable to create pipeline for shaders \"" << vertexModuleName << "\" and \"" << fragmentModuleName << "\"." << std::endl;
+		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+		vkDestroyShaderModule(device, fragShaderModule, nullptr);
+		return;
+	}
 	// Vertex shader module.
 	VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
 	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -25,7 +34,6 @@ void PipelineUtilities::createPipeline(const VkDevice & device, const std::strin
 	if (vertexOnly){
 		shaderStages = {vertShaderStageInfo};
 	} else {
-		fragShaderModule = VulkanUtilities::createShaderModule(device, "resources/shaders/compiled/" + moduleName + ".frag.spv");
 		VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
 		fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 		fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -38,12 +46,10 @@ void PipelineUtilities::createPipeline(const VkDevice & device, const std::strin
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	// Binding and attributes to use.
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(vertexLayout.bindings.size());
+	vertexInputInfo.pVertexBindingDescriptions = vertexLayout.bindings.data();
+	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertexLayout.attributes.size());
+	vertexInputInfo.pVertexAttributeDescriptions = vertexLayout.attributes.data();
 	
 	// Geometry assembly.
 	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
@@ -131,6 +137,9 @@ void PipelineUtilities::createPipeline(const VkDevice & device, const std::strin
 	
 	if(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
 		std::cerr << "Unable to create pipeline layout." << std::endl;
+		pipelineLayout = VK_NULL_HANDLE;
+		vkDestroyShaderModule(device, vertShaderModule, nullptr);
+		vkDestroyShaderModule(device, fragShaderModule, nullptr);
 		return;
 	}
 	
@@ -154,7 +163,7 @@ void PipelineUtilities::createPipeline(const VkDevice & device, const std::strin
 	pipelineInfo.basePipelineIndex = -1; // Optional
 	if(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
 		std::cerr << "Unable to create graphics pipeline." << std::endl;
-		
+		pipeline = VK_NULL_HANDLE;
 	}
 	
 	vkDestroyShaderModule(device, vertShaderModule, nullptr);
@@ -162,3 +171,43 @@ void PipelineUtilities::createPipeline(const VkDevice & device, const std::strin
 		vkDestroyShaderModule(device, fragShaderModule, nullptr);
 	}
 }
+
+void PipelineUtilities::createComputePipeline(const VkDevice & device, const std::string & computeModuleName, const VkDescriptorSetLayout & descriptorSetLayout, const int pushSize, VkPipelineLayout & pipelineLayout, VkPipeline & pipeline){
+	pipeline = VK_NULL_HANDLE;
+	pipelineLayout = VK_NULL_HANDLE;
+	VkShaderModule computeShaderModule = VulkanUtilities::createShaderModule(device, "resources/shaders/compiled/" + computeModuleName + ".comp.spv");
+	if(computeShaderModule == VK_NULL_HANDLE){
+		return;
+	}
+	// Pipeline layout.
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+	VkPushConstantRange pushConstantRange = {};
+	if(pushSize > 0){
+		pipelineLayoutInfo.pushConstantRangeCount = 1;
+		pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		pushConstantRange.offset = 0;
+		pushConstantRange.size = static_cast<uint32_t>(pushSize);
+		pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	}
+	if(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		std::cerr << "Unable to create pipeline layout." << std::endl;
+		vkDestroyShaderModule(device, computeShaderModule, nullptr);
+		return;
+	}
+	// And the pipeline.
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = computeShaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = pipelineLayout;
+	if(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+		std::cerr << "Unable to create compute pipeline." << std::endl;
+		pipeline = VK_NULL_HANDLE;
+	}
+	vkDestroyShaderModule(device, computeShaderModule, nullptr);
+}
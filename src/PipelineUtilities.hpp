@@ -10,10 +10,16 @@
 #define PipelineUtilities_hpp
 
 #include "common.hpp"
+#include "resources/MeshUtilities.hpp"
 
 class PipelineUtilities {
 public:
-	static void createPipeline(const VkDevice & device, const std::string & moduleName, const VkRenderPass & renderPass,const VkDescriptorSetLayout & descriptorSetLayout, const uint32_t width, const uint32_t height, const bool vertexOnly, const VkCullModeFlags cullMode, const bool depthTest, const bool depthWrite, const bool depthBias, const VkCompareOp compareOp, const int pushSize, VkPipelineLayout & pipelineLayout, VkPipeline & pipeline);
+	/// Create a graphics pipeline reading vertices with the given layout. If the fragment module name is empty, no fragment stage and color attachment are used.
+	/// The pipeline is VK_NULL_HANDLE if a module can't be loaded.
+	static void createPipeline(const VkDevice & device, const std::string & vertexModuleName, const std::string & fragmentModuleName, const VertexLayout & vertexLayout, const VkRenderPass & renderPass,const VkDescriptorSetLayout & descriptorSetLayout, const uint32_t width, const uint32_t height, const VkCullModeFlags cullMode, const bool depthTest, const bool depthWrite, const bool depthBias, const VkCompareOp compareOp, const int pushSize, VkPipelineLayout & pipelineLayout, VkPipeline & pipeline);
+	
+	/// Create a compute pipeline, the pipeline is VK_NULL_HANDLE if the module can't be loaded.
+	static void createComputePipeline(const VkDevice & device, const std::string & computeModuleName, const VkDescriptorSetLayout & descriptorSetLayout, const int pushSize, VkPipelineLayout & pipelineLayout, VkPipeline & pipeline);
 };
 
 #endif /* PipelineUtilities_hpp */
@@ -1,16 +1,22 @@
 #include "Renderer.hpp"
 #include "VulkanUtilities.hpp"
 #include "PipelineUtilities.hpp"
+#include "ThreadUtilities.hpp"
+#include "MipmapGenerator.hpp"
+#include "UploadContext.hpp"
 #include "resources/Resources.hpp"
 
 #include <array>
+#include <limits>
+#include <future>
+#include <thread>
 
 
 
 Renderer::~Renderer(){
 }
 
-Renderer::Renderer(Swapchain & swapchain, const int width, const int height) : _skybox("cubemap"), _shadowPass(2048, 2048){
+Renderer::Renderer(Swapchain & swapchain, const int width, const int height, const MeshUtilities::VertexFormat vertexFormat) : _vertexFormat(vertexFormat), _skybox("cubemap"), _shadowPass(2048, 2048){
 	
 	const auto & physicalDevice = swapchain.physicalDevice;
 	const auto & commandPool = swapchain.commandPool;
@@ -22,29 +28,92 @@ Renderer::Renderer(Swapchain & swapchain, const int width, const int height) : _
 	_lightProj = glm::ortho(-5.0, 5.0, -5.0, 5.0, 0.1, 5.0);
 	_lightProj[1][1] *= -1;
 	_worldLightDir = glm::normalize(glm::vec4(1.0f,1.0f,1.0f,0.0f));
-	glm::mat4 lightView = glm::lookAt(2.0f*glm::vec3(_worldLightDir), glm::vec3(0.0f), glm::vec3(0.0,1.0,0.0));
-	_lightViewproj = _lightProj * lightView;
+	_lightView = glm::lookAt(2.0f*glm::vec3(_worldLightDir), glm::vec3(0.0f), glm::vec3(0.0,1.0,0.0));
+	_lightViewproj = _lightProj * _lightView;
 	
 	_objects.emplace_back("dragon", 64);
 	_objects.back().infos.model = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(-0.5f,0.0f,-0.5f)), glm::vec3(1.2f));
 	_objects.emplace_back("suzanne", 8);
 	_objects.back().infos.model = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.5, 0.0, 0.5)), glm::vec3(0.65f));
-	_objects.emplace_back("plane", 32);
+	// The ground never shadows the other objects.
+	_objects.emplace_back("plane", 32, false, true);
 	_objects.back().infos.model = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0,-0.8,0.0)), glm::vec3(2.75f));
 	_skybox.infos.model = glm::scale(glm::mat4(1.0f), glm::vec3(15.0f));
 	
 	_size = glm::vec2(width, height);
 	
-	_shadowPass.init(physicalDevice, _device, commandPool,count);
+	// The compact format is decoded by a variant of the object vertex shader, compiled by compile.sh.
+	if(_vertexFormat == MeshUtilities::Compact && !MappedFile("resources/shaders/compiled/object_compact.vert.spv").valid()){
+		std::cerr << "Unable to find the compact vertex shader, using the standard vertex format." << std::endl;
+		_vertexFormat = MeshUtilities::Standard;
+	}
 	
-	// Create sampler.
-	_textureSampler = VulkanUtilities::createSampler(_device, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, MAX_MIPMAP_LEVELS);
+	_shadowPass.init(_device, commandPool,count, _vertexFormat);
+	_textures.init(physicalDevice, _device, count);
+	_defragmenter.init(_device, count);
 	
-	// Objects setup.
-	for(auto & object : _objects){
-		object.upload(physicalDevice, _device, commandPool, graphicsQueue);
+	// Create sampler.
+	_textureSampler = VulkanUtilities::createSampler(_device, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_REPEAT, VK_LOD_CLAMP_NONE);
+	
+	// Assets setup: CPU loading runs in parallel in the background,
+	// each asset is uploaded from this thread as soon as its data is ready.
+	// Object textures only get their coarsest levels, the others are streamed when rendering.
+	// Textures without cooked levels have their mipmaps generated together at the end.
+	// All uploads are recorded in a few batches, waited on once at the end.
+	// Copies run on the transfer queue if there is one, overlapping with the loading and the graphics work.
+	UploadContext upload(physicalDevice, _device, swapchain.queueFamilies, commandPool, graphicsQueue, swapchain.transferCommandPool, swapchain.transferQueue);
+	MipmapGenerator mipmaps(_device);
+	const auto loadStart = std::chrono::steady_clock::now();
+	const size_t assetsCount = _objects.size() + 1;
+	std::vector<std::promise<void>> loaded(assetsCount);
+	const bool compressedTextures = swapchain.compressedTextures;
+	std::thread loader([this, assetsCount, compressedTextures, &loaded](){
+		ThreadUtilities::parallelFor(assetsCount, ThreadUtilities::threadCount(), [this, compressedTextures, &loaded](unsigned int, size_t begin, size_t end){
+			for(size_t aid = begin; aid < end; ++aid){
+				// A failure is forwarded to the uploading thread.
+				try {
+					if(aid < _objects.size()){
+						_objects[aid].load(_vertexFormat, compressedTextures);
+					} else {
+						_skybox.load(_device, _vertexFormat);
+					}
+					loaded[aid].set_value();
+				} catch(...){
+					loaded[aid].set_exception(std::current_exception());
+				}
+			}
+		});
+	});
+	std::exception_ptr failure;
+	for(size_t aid = 0; aid < assetsCount; ++aid){
+		try {
+			loaded[aid].get_future().get();
+		} catch(...){
+			// Wait for the other assets and the pending uploads before reporting it.
+			if(!failure){
+				failure = std::current_exception();
+			}
+			continue;
+		}
+		if(aid < _objects.size()){
+			Object & object = _objects[aid];
+			object.upload(_device, upload, _textures);
+			// Visible meshlets are written for the shadow and final passes.
+			object.createCulledIndexBuffers(_device, count, 2);
+		} else {
+			_skybox.upload(_device, upload, mipmaps);
+		}
+	}
+	loader.join();
+	mipmaps.flush(physicalDevice, _device, upload);
+	upload.finish();
+	mipmaps.clean(_device);
+	upload.clean();
+	if(failure){
+		std::rethrow_exception(failure);
 	}
-	_skybox.upload(physicalDevice, _device, commandPool, graphicsQueue);
+	const std::chrono::duration<double, std::milli> loadDuration = std::chrono::steady_clock::now() - loadStart;
+	std::cout << "Assets loaded in " << loadDuration.count() << "ms on " << ThreadUtilities::threadCount() << " threads, with " << upload.submissionsCount() << " upload submissions." << std::endl;
 	
 	Skybox::createDescriptorSetLayout(_device, _textureSampler);
 	Object::createDescriptorSetLayout(_device, _textureSampler, _shadowPass.depthSampler);
@@ -58,8 +127,10 @@ Renderer::Renderer(Swapchain & swapchain, const int width, const int height) : _
 	_uniformBuffers.resize(count);
 	_uniformBuffersMemory.resize(count);
 	for (size_t i = 0; i < count; i++) {
-		VulkanUtilities::createBuffer(physicalDevice, _device, bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _uniformBuffers[i], _uniformBuffersMemory[i]);
+		VulkanUtilities::createBuffer(_device, bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _uniformBuffers[i], _uniformBuffersMemory[i]);
 	}
+	const MemoryAllocator::Statistics memory = MemoryAllocator::statistics();
+	std::cout << "Device memory: " << memory.allocations << " allocations in " << memory.blocks << " blocks, " << (memory.freeSize >> 10) << "KB free, largest free range " << (memory.largestFree >> 10) << "KB." << std::endl;
 	
 	// Create descriptor pools.
 	// 2 pools: one for uniform, one for image+sampler.
@@ -93,8 +164,11 @@ Renderer::Renderer(Swapchain & swapchain, const int width, const int height) : _
 }
 void Renderer::createPipelines(const VkRenderPass & finalRenderPass){
 	const int pushSize = (16 + 1) * 4;
-	PipelineUtilities::createPipeline(_device, "object", finalRenderPass, Object::descriptorSetLayout, _size[0], _size[1], false, VK_CULL_MODE_BACK_BIT, true, true, false, VK_COMPARE_OP_LESS, pushSize, _objectPipelineLayout, _objectPipeline);
-	PipelineUtilities::createPipeline(_device, "skybox", finalRenderPass, Skybox::descriptorSetLayout, _size[0], _size[1], false, VK_CULL_MODE_FRONT_BIT, true, false, false, VK_COMPARE_OP_EQUAL, pushSize, _skyboxPipelineLayout, _skyboxPipeline);
+	const VertexLayout vertexLayout = MeshUtilities::vertexLayout(_vertexFormat);
+	// The compact format is decoded by a variant of the object vertex shader.
+	const std::string objectVertexModule = _vertexFormat == MeshUtilities::Compact ? "object_compact" : "object";
+	PipelineUtilities::createPipeline(_device, objectVertexModule, "object", vertexLayout, finalRenderPass, Object::descriptorSetLayout, _size[0], _size[1], VK_CULL_MODE_BACK_BIT, true, true, false, VK_COMPARE_OP_LESS, pushSize, _objectPipelineLayout, _objectPipeline);
+	PipelineUtilities::createPipeline(_device, "skybox", "skybox", vertexLayout, finalRenderPass, Skybox::descriptorSetLayout, _size[0], _size[1], VK_CULL_MODE_FRONT_BIT, true, false, false, VK_COMPARE_OP_EQUAL, pushSize, _skyboxPipelineLayout, _skyboxPipeline);
 }
 
 void Renderer::updateUniforms(const uint32_t index){
@@ -107,11 +181,9 @@ void Renderer::updateUniforms(const uint32_t index){
 	light.mvp = _lightViewproj;
 	light.viewSpaceDir = glm::vec3(glm::normalize(ubo.view * _worldLightDir));
 	// Send data.
-	void* data;
-	vkMapMemory(_device, _uniformBuffersMemory[index], 0, sizeof(ubo)+sizeof(light), 0, &data);
+	char * data = _uniformBuffersMemory[index].data;
 	memcpy(data, &ubo, sizeof(ubo));
-	memcpy(static_cast<char*>(data) + VulkanUtilities::nextOffset(sizeof(CameraInfos)), &light, sizeof(light));
-	vkUnmapMemory(_device, _uniformBuffersMemory[index]);
+	memcpy(data + VulkanUtilities::nextOffset(sizeof(CameraInfos)), &light, sizeof(light));
 	
 }
 
@@ -120,6 +192,7 @@ void Renderer::encode(const VkQueue & graphicsQueue, const uint32_t imageIndex,
 	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
 	
 	updateUniforms(imageIndex);
+	buildDrawLists(imageIndex);
 	
 	VkCommandBufferBeginInfo beginInfo = {};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -127,6 +200,19 @@ void Renderer::encode(const VkQueue & graphicsQueue, const uint32_t imageIndex,
 	
 	vkBeginCommandBuffer(finalCommmandBuffer, &beginInfo);
 	
+	// Stream the texture levels requested by the visible objects, before any descriptor set is bound.
+	_textures.update(finalCommmandBuffer);
+	// Then move some of the resources of the evacuated memory blocks. The draw lists can still use the previous buffers, they are kept alive.
+	_defragmenter.begin();
+	_textures.defragment(finalCommmandBuffer, _defragmenter);
+	for(auto & object : _objects){
+		object.defragment(finalCommmandBuffer, _defragmenter);
+	}
+	_skybox.defragment(finalCommmandBuffer, _defragmenter);
+	for(auto & object : _objects){
+		object.updateDescriptorSets(_device, imageIndex);
+	}
+	
 	VkRenderPassBeginInfo shadowInfos = {};
 	shadowInfos.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	shadowInfos.renderPass = _shadowPass.renderPass;
@@ -139,14 +225,19 @@ void Renderer::encode(const VkQueue & graphicsQueue, const uint32_t imageIndex,
 	shadowInfos.pClearValues = clearValuesShadow.data();
 	
 	vkCmdBeginRenderPass(finalCommmandBuffer, &shadowInfos, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _shadowPass.pipeline);
-	for(auto & object : _objects){
-		VkBuffer vertexBuffers[] = {object._vertexBuffer};
-		vkCmdBindVertexBuffers(finalCommmandBuffer, 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(finalCommmandBuffer, object._indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _shadowPass.pipelineLayout, 0, 1, &object.shadowDescriptorSet(imageIndex), 0, nullptr);
-		vkCmdPushConstants(finalCommmandBuffer, _shadowPass.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, (16+1)*4, &object.infos);
-		vkCmdDrawIndexed(finalCommmandBuffer, object._count, 1, 0, 0, 0);
+	// Pipelines whose shaders couldn't be loaded are skipped.
+	if(_shadowPass.pipeline != VK_NULL_HANDLE){
+		vkCmdBindPipeline(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _shadowPass.pipeline);
+		for(const auto & draw : _shadowDraws){
+			const Object & object = *draw.object;
+			// Only positions are needed.
+			VkBuffer vertexBuffers[] = {object._positionBuffer};
+			vkCmdBindVertexBuffers(finalCommmandBuffer, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(finalCommmandBuffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			vkCmdBindDescriptorSets(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _shadowPass.pipelineLayout, 0, 1, &object.shadowDescriptorSet(imageIndex), 0, nullptr);
+			vkCmdPushConstants(finalCommmandBuffer, _shadowPass.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, (16+1)*4, &object.infos);
+			vkCmdDrawIndexed(finalCommmandBuffer, draw.indicesCount, 1, draw.firstIndex, 0, 0);
+		}
 	}
 	vkCmdEndRenderPass(finalCommmandBuffer);
 	
@@ -179,22 +270,27 @@ void Renderer::encode(const VkQueue & graphicsQueue, const uint32_t imageIndex,
 	vkCmdBeginRenderPass(finalCommmandBuffer, &finalPassInfos, VK_SUBPASS_CONTENTS_INLINE);
 	
 	// Bind and draw.
-	vkCmdBindPipeline(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _objectPipeline);
-	for(auto & object : _objects){
-		VkBuffer vertexBuffers[] = {object._vertexBuffer};
+	if(_objectPipeline != VK_NULL_HANDLE){
+		vkCmdBindPipeline(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _objectPipeline);
+		for(const auto & draw : _objectDraws){
+			const Object & object = *draw.object;
+			VkBuffer vertexBuffers[] = {object._vertexBuffer};
+			vkCmdBindVertexBuffers(finalCommmandBuffer, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(finalCommmandBuffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+			vkCmdBindDescriptorSets(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _objectPipelineLayout, 0, 1, &object.descriptorSet(imageIndex), 0, nullptr);
+			vkCmdPushConstants(finalCommmandBuffer, _objectPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, (16+1)*4, &object.infos);
+			vkCmdDrawIndexed(finalCommmandBuffer, draw.indicesCount, 1, draw.firstIndex, 0, 0);
+		}
+	}
+	if(_skyboxPipeline != VK_NULL_HANDLE && _skybox._count > 0){
+		vkCmdBindPipeline(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _skyboxPipeline);
+		VkBuffer vertexBuffers[] = {_skybox._vertexBuffer};
 		vkCmdBindVertexBuffers(finalCommmandBuffer, 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(finalCommmandBuffer, object._indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _objectPipelineLayout, 0, 1, &object.descriptorSet(imageIndex), 0, nullptr);
-		vkCmdPushConstants(finalCommmandBuffer, _objectPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, (16+1)*4, &object.infos);
-		vkCmdDrawIndexed(finalCommmandBuffer, object._count, 1, 0, 0, 0);
+		vkCmdBindIndexBuffer(finalCommmandBuffer, _skybox._indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		vkCmdBindDescriptorSets(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _skyboxPipelineLayout, 0, 1, &_skybox.descriptorSet(imageIndex), 0, nullptr);
+		vkCmdPushConstants(finalCommmandBuffer, _skyboxPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, (16+1)*4, &_skybox.infos.model);
+		vkCmdDrawIndexed(finalCommmandBuffer, _skybox._count, 1, 0, 0, 0);
 	}
-	vkCmdBindPipeline(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _skyboxPipeline);
-	VkBuffer vertexBuffers[] = {_skybox._vertexBuffer};
-	vkCmdBindVertexBuffers(finalCommmandBuffer, 0, 1, vertexBuffers, offsets);
-	vkCmdBindIndexBuffer(finalCommmandBuffer, _skybox._indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-	vkCmdBindDescriptorSets(finalCommmandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _skyboxPipelineLayout, 0, 1, &_skybox.descriptorSet(imageIndex), 0, nullptr);
-	vkCmdPushConstants(finalCommmandBuffer, _skyboxPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, (16+1)*4, &_skybox.infos.model);
-	vkCmdDrawIndexed(finalCommmandBuffer, _skybox._count, 1, 0, 0, 0);
 	
 	// Finish final pass and command buffer.
 	vkCmdEndRenderPass(finalCommmandBuffer);
@@ -216,14 +312,102 @@ void Renderer::encode(const VkQueue & graphicsQueue, const uint32_t imageIndex,
 	vkQueueSubmit(graphicsQueue, 1, &submitInfo, submissionFence);
 }
 
+Renderer::Draw Renderer::prepareDraw(const Object & object, const uint32_t imageIndex, const uint32_t slot, const glm::mat4 & view, const glm::mat4 & projection, const float height, const glm::vec4 & viewer) const {
+	const MeshCache::Lod & lod = object.lod(view, projection, height, _lodThreshold);
+	Draw draw = { &object, object._indexBuffer, lod.firstIndex, lod.indicesCount };
+	// Meshlets only cover the full resolution level.
+	if(lod.firstIndex != 0 || object._culledIndexBuffers.empty()){
+		return draw;
+	}
+	const uint32_t visibleCount = object.cullMeshlets(imageIndex, slot, projection * view, viewer);
+	if(visibleCount < lod.indicesCount){
+		draw.indexBuffer = object._culledIndexBuffers[imageIndex];
+		draw.firstIndex = slot * lod.indicesCount;
+		draw.indicesCount = visibleCount;
+	}
+	return draw;
+}
+
+void Renderer::buildDrawLists(const uint32_t imageIndex){
+	_objectDraws.clear();
+	_shadowDraws.clear();
+	_cullingStatistics = CullingStatistics();
+	
+	// Objects in the camera frustum, and light space box of the visible receivers.
+	const glm::mat4 view = _camera.view();
+	const glm::mat4 projection = _camera.projection();
+	const glm::vec4 eye = glm::inverse(view)[3];
+	const Frustum frustum(projection * view);
+	glm::vec3 receiversMin(std::numeric_limits<float>::max());
+	glm::vec3 receiversMax(-std::numeric_limits<float>::max());
+	for(const auto & object : _objects){
+		if(!object.visible(frustum)){
+			++_cullingStatistics.culled;
+			continue;
+		}
+		++_cullingStatistics.visible;
+		if(object._receiveShadows){
+			glm::vec3 center, extent;
+			object.bounds(_lightView, center, extent);
+			receiversMin = glm::min(receiversMin, center - extent);
+			receiversMax = glm::max(receiversMax, center + extent);
+		}
+		const Draw draw = prepareDraw(object, imageIndex, 0, view, projection, _size[1], eye);
+		if(draw.indicesCount > 0){
+			_objectDraws.push_back(draw);
+			const float pixels = object.screenSize(view, projection, _size[1]);
+			_textures.request(*object._colorTexture, pixels);
+			_textures.request(*object._normalTexture, pixels);
+		}
+	}
+	
+	// Only the part of the receivers covered by the shadow map can be shadowed.
+	// The light looks down -z in its view space: the light frustum is only bounded by the far plane along z,
+	// as casters between the light and the near plane still shadow the receivers.
+	const glm::mat4 lightInverseProj = glm::inverse(_lightProj);
+	glm::vec3 lightMin(std::numeric_limits<float>::max());
+	glm::vec3 lightMax(-std::numeric_limits<float>::max());
+	for(int corner = 0; corner < 8; ++corner){
+		const glm::vec4 ndc((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : 0.0f, 1.0f);
+		const glm::vec4 point = lightInverseProj * ndc;
+		lightMin = glm::min(lightMin, glm::vec3(point) / point.w);
+		lightMax = glm::max(lightMax, glm::vec3(point) / point.w);
+	}
+	receiversMin = glm::max(receiversMin, lightMin);
+	receiversMax = glm::min(receiversMax, lightMax);
+	
+	// A caster shadow extends away from the light: it can reach the receivers if their boxes overlap
+	// in the light plane and part of the caster is nearer to the light than the farthest receiver.
+	// Without any visible receiver, the bounds are empty and all casters are skipped.
+	for(const auto & object : _objects){
+		if(!object._castShadows){
+			continue;
+		}
+		glm::vec3 center, extent;
+		object.bounds(_lightView, center, extent);
+		const glm::vec3 casterMin = center - extent;
+		const glm::vec3 casterMax = center + extent;
+		if(casterMin.x > receiversMax.x || casterMax.x < receiversMin.x || casterMin.y > receiversMax.y || casterMax.y < receiversMin.y || casterMax.z < receiversMin.z){
+			++_cullingStatistics.culledCasters;
+			continue;
+		}
+		++_cullingStatistics.casters;
+		// Level of detail based on the size of the object in the shadow map, meshlets facing the light.
+		const Draw draw = prepareDraw(object, imageIndex, 1, _lightView, _lightProj, float(_shadowPass.extent.height), _worldLightDir);
+		if(draw.indicesCount > 0){
+			_shadowDraws.push_back(draw);
+		}
+	}
+}
+
 void Renderer::update(const double deltaTime) {
 	_time += deltaTime;
 	_camera.update();
 	_camera.physics(deltaTime);
 	
 	_worldLightDir = glm::normalize(glm::vec4(1.0,0.5*sin(_time)+0.6, 1.0,0.0));
-	glm::mat4 lightView = glm::lookAt(2.0f*glm::vec3(_worldLightDir), glm::vec3(0.0f), glm::vec3(0.0,1.0,0.0));
-	_lightViewproj = _lightProj * lightView;
+	_lightView = glm::lookAt(2.0f*glm::vec3(_worldLightDir), glm::vec3(0.0f), glm::vec3(0.0,1.0,0.0));
+	_lightViewproj = _lightProj * _lightView;
 	
 	//TODO: don't rely on arbitrary indexing.
 	_objects[1].infos.model = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.5,0.0,0.5)), float(fmod(_time, 2*M_PI)), glm::vec3(0.0f,1.0f,0.0f)) , glm::vec3(0.65));
@@ -258,11 +442,13 @@ void Renderer::clean(){
 
 	for (size_t i = 0; i < _uniformBuffers.size(); i++) {
 		vkDestroyBuffer(_device, _uniformBuffers[i], nullptr);
-		vkFreeMemory(_device, _uniformBuffersMemory[i], nullptr);
+		MemoryAllocator::free(_uniformBuffersMemory[i]);
 	}
 	for(auto & object : _objects){
 		object.clean(_device);
 	}
+	_textures.clean();
+	_defragmenter.clean();
 	_skybox.clean(_device);
 	
 	_shadowPass.clean(_device);
@@ -3,6 +3,8 @@
 #include "Skybox.hpp"
 #include "ShadowPass.hpp"
 #include "Swapchain.hpp"
+#include "TextureStreamer.hpp"
+#include "Defragmenter.hpp"
 
 #include "VulkanUtilities.hpp"
 #include "input/ControllableCamera.hpp"
@@ -15,8 +17,16 @@
 class Renderer
 {
 public:
+	
+	/// Objects drawn and skipped in the final and shadow passes during the last frame.
+	struct CullingStatistics {
+		uint32_t visible = 0;
+		uint32_t culled = 0;
+		uint32_t casters = 0;
+		uint32_t culledCasters = 0;
+	};
 
-	Renderer(Swapchain & swapchain, const int width, const int height);
+	Renderer(Swapchain & swapchain, const int width, const int height, const MeshUtilities::VertexFormat vertexFormat);
 
 	~Renderer();
 
@@ -26,6 +36,20 @@ public:
 	
 	void resize(VkRenderPass & finalRenderPass, const int width, const int height);
 	
+	/// Set the maximum error allowed when picking a level of detail, in pixels.
+	void lodThreshold(const float pixels){ _lodThreshold = pixels; }
+	
+	/// Set the device memory available to textures, and the size of the texture levels uploaded each frame, in bytes.
+	void textureBudgets(const size_t resident, const size_t upload){ _textures.budgets(resident, upload); }
+	
+	/// Set the size of the resources moved each frame to compact device memory, in bytes.
+	void defragmentationBudget(const size_t budget){ _defragmenter.budget(budget); }
+	
+	/// Device memory used by textures, in bytes.
+	size_t textureSize() const { return size_t(_textures.residentSize()); }
+	
+	const CullingStatistics & cullingStatistics() const { return _cullingStatistics; }
+	
 	void clean();
 	
 private:
@@ -33,15 +57,35 @@ private:
 	void createPipelines(const VkRenderPass & finalRenderPass);
 	void updateUniforms(const uint32_t index);
 	
+	/// Indices to draw for an object in a pass.
+	struct Draw {
+		const Object * object;
+		VkBuffer indexBuffer;
+		uint32_t firstIndex;
+		uint32_t indicesCount;
+	};
+	
+	/// Pick the level of detail of an object for a pass and cull its meshlets when drawn at full resolution.
+	Draw prepareDraw(const Object & object, const uint32_t imageIndex, const uint32_t slot, const glm::mat4 & view, const glm::mat4 & projection, const float height, const glm::vec4 & viewer) const;
+	
+	/// Fill the final pass list with the objects in the camera frustum, and the shadow pass list with the casters that can shadow the visible receivers.
+	void buildDrawLists(const uint32_t imageIndex);
+	
 	glm::vec2 _size = glm::vec2(0.0f,0.0f);
+	MeshUtilities::VertexFormat _vertexFormat;
+	float _lodThreshold = 1.0f;
+	CullingStatistics _cullingStatistics;
 	double _time = 0.0;
 	
 	// Scene.
 	std::vector<Object> _objects;
+	TextureStreamer _textures;
+	Defragmenter _defragmenter;
 	Skybox _skybox;
 	ControllableCamera _camera;
 	// Light
 	glm::mat4 _lightViewproj;
+	glm::mat4 _lightView;
 	glm::vec4 _worldLightDir;
 	glm::mat4 _lightProj;
 	
@@ -58,8 +102,10 @@ private:
 	VkPipeline _skyboxPipeline;
 	
 	// Per frame data.
+	std::vector<Draw> _objectDraws;
+	std::vector<Draw> _shadowDraws;
 	std::vector<VkBuffer> _uniformBuffers;
-	std::vector<VkDeviceMemory> _uniformBuffersMemory;
+	std::vector<MemoryAllocator::Allocation> _uniformBuffersMemory;
 	
 	
 };
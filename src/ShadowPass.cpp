@@ -19,18 +19,18 @@ ShadowPass::ShadowPass(const int width, const int height){
 	extent = {static_cast<uint32_t>(size[0]), static_cast<uint32_t>(size[1])};
 }
 
-void ShadowPass::init(const VkPhysicalDevice & physicalDevice,const VkDevice & device, const VkCommandPool & commandPool, const  uint32_t count ){
+void ShadowPass::init(const VkDevice & device, const VkCommandPool & commandPool, const  uint32_t count, const MeshUtilities::VertexFormat format){
 	frameBuffers.resize(count);
 	depthImages.resize(count);
 	depthMemorys.resize(count);
 	depthViews.resize(count);
 	descriptors.resize(count);
 	// Create a sampler for the shadow map.
-	depthSampler = VulkanUtilities::createSampler(device, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, 1);
+	depthSampler = VulkanUtilities::createSampler(device, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, 1.0f);
 	// Init shadow pass and framebuffer.
 	// For shadow mapping we only need a depth attachment
 	for(size_t i = 0; i < count; ++i){
-		VulkanUtilities::createImage(physicalDevice, device, size[0], size[1], 1, VK_FORMAT_D32_SFLOAT , VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, depthImages[i], depthMemorys[i]);
+		VulkanUtilities::createImage(device, size[0], size[1], 1, VK_FORMAT_D32_SFLOAT , VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, depthImages[i], depthMemorys[i]);
 		depthViews[i] = VulkanUtilities::createImageView(device, depthImages[i], VK_FORMAT_D32_SFLOAT, VK_IMAGE_ASPECT_DEPTH_BIT, false, 1);
 	}
 	
@@ -98,7 +98,7 @@ void ShadowPass::init(const VkPhysicalDevice & physicalDevice,const VkDevice & d
 	
 	ShadowPass::createDescriptorSetLayout(device);
 	const int pushSize = (16 + 1) * 4;
-	PipelineUtilities::createPipeline(device, "shadow", renderPass, descriptorSetLayout, size[0], size[1], true, VK_CULL_MODE_BACK_BIT, true, true, true, VK_COMPARE_OP_LESS, pushSize, pipelineLayout, pipeline);
+	PipelineUtilities::createPipeline(device, "shadow", "", MeshUtilities::positionLayout(format), renderPass, descriptorSetLayout, size[0], size[1], VK_CULL_MODE_BACK_BIT, true, true, true, VK_COMPARE_OP_LESS, pushSize, pipelineLayout, pipeline);
 }
 
 VkDescriptorSetLayout ShadowPass::createDescriptorSetLayout(const VkDevice & device){
@@ -131,7 +131,7 @@ void ShadowPass::clean(const VkDevice & device){
 	for(size_t i = 0; i < frameBuffers.size(); ++i){
 		vkDestroyImageView(device, depthViews[i], nullptr);
 		vkDestroyImage(device, depthImages[i], nullptr);
-		vkFreeMemory(device, depthMemorys[i], nullptr);
+		MemoryAllocator::free(depthMemorys[i]);
 		vkDestroyFramebuffer(device, frameBuffers[i], nullptr);
 	}
 	vkDestroyRenderPass(device, renderPass, nullptr);
@@ -18,7 +18,7 @@ public:
 	
 	ShadowPass(const int width, const int height);
 	
-	void init(const VkPhysicalDevice & physicalDevice,const VkDevice & device, const VkCommandPool & commandPool, const uint32_t count);
+	void init(const VkDevice & device, const VkCommandPool & commandPool, const uint32_t count, const MeshUtilities::VertexFormat format);
 	
 	void clean(const VkDevice & device);
 	
@@ -36,7 +36,7 @@ public:
 	// Per frame data.
 	std::vector<VkFramebuffer> frameBuffers;
 	std::vector<VkImage> depthImages;
-	std::vector<VkDeviceMemory> depthMemorys;
+	std::vector<MemoryAllocator::Allocation> depthMemorys;
 	std::vector<VkImageView>depthViews;
 	std::vector<VkDescriptorImageInfo> descriptors;
 };
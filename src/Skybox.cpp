@@ -9,6 +9,11 @@
 #include "Skybox.hpp"
 #include "VulkanUtilities.hpp"
 #include "resources/Resources.hpp"
+#include "resources/MeshCache.hpp"
+#include "ThreadUtilities.hpp"
+#include "resources/TextureUtilities.hpp"
+
+#include <atomic>
 
 VkDescriptorSetLayout Skybox::descriptorSetLayout = VK_NULL_HANDLE;
 
@@ -20,40 +25,86 @@ Skybox::Skybox(const std::string &name) {
 	infos.shininess = 0;
 }
 
-void Skybox::upload(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue) {
-	
-	// Mesh.
-	Mesh mesh;
-	const std::string meshPath = "resources/meshes/cubemap.obj";
-	MeshUtilities::loadObj(meshPath, mesh, MeshUtilities::Indexed);
-	MeshUtilities::centerAndUnitMesh(mesh);
-	MeshUtilities::computeTangentsAndBinormals(mesh);
-	
-	/// Buffers.
-	VulkanUtilities::setupBuffers(physicalDevice, device, commandPool, graphicsQueue, mesh, _vertexBuffer, _vertexBufferMemory, _indexBuffer, _indexBufferMemory);
+void Skybox::load(const VkDevice & device, const MeshUtilities::VertexFormat format) {
 	
-	_count  = static_cast<uint32_t>(mesh.indices.size());
+	// Mesh, processed on first use then read from its binary cache.
+	_mesh = std::make_shared<MeshCache>("resources/meshes/cubemap.obj");
+	// Without geometry, the skybox is never drawn.
+	if(!_mesh->valid()){
+		std::cerr << "Error loading skybox mesh." << std::endl;
+	} else {
+		if(format == MeshUtilities::Compact){
+			MeshUtilities::compressVertices(_mesh->vertices(), _mesh->verticesCount(), _compactVertices);
+		}
+		_count  = _mesh->lod(0).indicesCount;
+	}
 	
 	/// Textures.
-	unsigned int texWidth, texHeight, texChannels;
-	char* images[6];
+	// All faces share the size of the first one.
 	const std::vector<std::string> suffixes = {"r", "l", "u", "d", "b", "f"};
-	int rett = 0;
-	for(size_t i = 0; i < 6; ++i){
-		rett = Resources::loadImage("resources/textures/" + _name + "_" + suffixes[i] + ".png", texWidth, texHeight, texChannels, (void**)&images[i], false);
+	if(Resources::imageInfos("resources/textures/" + _name + "_" + suffixes[0] + ".png", _texWidth, _texHeight) != 0 || _texWidth == 0 || _texHeight == 0){
+		std::cerr << "Error loading cubemap image." << std::endl;
+		_texWidth = 0;
+		_texHeight = 0;
 	}
-	const int layerSize = texWidth*texHeight*texChannels;
-	char* mergedImages = (char*)malloc(6*layerSize);
-	for(size_t i = 0; i < 6; ++i){
-		memcpy(mergedImages + i*layerSize, images[i], layerSize);
+	// The staging buffer can always hold the fallback black 1x1 faces.
+	const size_t layerSize = std::max(size_t(1), size_t(_texWidth) * _texHeight) * 4;
+	VulkanUtilities::createBuffer(device, 6 * layerSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _stagingBuffer, _stagingBufferMemory);
+	char * staging = _stagingBufferMemory.data;
+	std::atomic<bool> failed(_texWidth == 0);
+	// Decode the faces in parallel, each one directly copied in its layer of the staging buffer.
+	if(!failed){
+		ThreadUtilities::parallelFor(6, ThreadUtilities::threadCount(), [&](unsigned int, size_t begin, size_t end){
+			for(size_t i = begin; i < end; ++i){
+				char * layer = staging + i * layerSize;
+				unsigned int texWidth, texHeight, texChannels;
+				void * image;
+				const int rett = Resources::loadImage("resources/textures/" + _name + "_" + suffixes[i] + ".png", texWidth, texHeight, texChannels, &image, false);
+				if(rett != 0 || texWidth != _texWidth || texHeight != _texHeight){
+					std::cerr << "Error loading cubemap image." << std::endl;
+					failed = true;
+					if(rett == 0){
+						free(image);
+					}
+					continue;
+				}
+				memcpy(layer, image, layerSize);
+				free(image);
+			}
+		});
 	}
-	VulkanUtilities::createTexture(mergedImages, texWidth, texHeight, true, MAX_MIPMAP_LEVELS, physicalDevice, device, commandPool, graphicsQueue, _textureCubeImage, _textureCubeMemory, _textureCubeView);
+	if(failed){
+		std::cerr << "Using a black cubemap." << std::endl;
+		_texWidth = 1;
+		_texHeight = 1;
+		memset(staging, 0, 6 * 4);
+	}
+}
+
+void Skybox::upload(const VkDevice & device, UploadContext & upload, MipmapGenerator & mipmaps) {
+	const MeshCache & mesh = *_mesh;
 	
-	// Cleaning.
-	for(size_t i = 0; i < 6; ++i){
-		free(images[i]);
+	/// Buffers.
+	if(mesh.valid()){
+		if(!_compactVertices.empty()){
+			VulkanUtilities::setupBuffers(device, upload, _compactVertices.data(), sizeof(CompactVertex) * _compactVertices.size(), mesh.indices(), mesh.indicesCount(), _vertexBuffer, _vertexBufferMemory, _indexBuffer, _indexBufferMemory);
+		} else {
+			VulkanUtilities::setupBuffers(device, upload, mesh.vertices(), sizeof(Vertex) * mesh.verticesCount(), mesh.indices(), mesh.indicesCount(), _vertexBuffer, _vertexBufferMemory, _indexBuffer, _indexBufferMemory);
+		}
+		_vertexBufferSize = _compactVertices.empty() ? sizeof(Vertex) * mesh.verticesCount() : sizeof(CompactVertex) * _compactVertices.size();
+		_indexBufferSize = sizeof(uint32_t) * mesh.indicesCount();
+		// The geometry can be moved when defragmenting.
+		MemoryAllocator::setMovable(_vertexBufferMemory);
+		MemoryAllocator::setMovable(_indexBufferMemory);
 	}
-	free(mergedImages);
+	
+	/// Textures.
+	VulkanUtilities::createTextureFromBuffer(_stagingBuffer, 0, _texWidth, _texHeight, true, TextureUtilities::levelsCount(_texWidth, _texHeight), device, upload, mipmaps, _textureCubeImage, _textureCubeMemory, _textureCubeView);
+	
+	// Release the CPU copies, the staging buffer once the copy is done.
+	upload.release(_stagingBuffer, _stagingBufferMemory);
+	_mesh.reset();
+	std::vector<CompactVertex>().swap(_compactVertices);
 }
 
 void Skybox::generateDescriptorSets(const VkDevice & device, const VkDescriptorPool & pool, const std::vector<VkBuffer> & constants, const int count){
@@ -100,15 +151,20 @@ void Skybox::generateDescriptorSets(const VkDevice & device, const VkDescriptorP
 	}
 }
 
+void Skybox::defragment(VkCommandBuffer & commandBuffer, Defragmenter & defragmenter){
+	defragmenter.relocate(commandBuffer, _vertexBuffer, _vertexBufferMemory, _vertexBufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	defragmenter.relocate(commandBuffer, _indexBuffer, _indexBufferMemory, _indexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+}
+
 void Skybox::clean(VkDevice & device){
 	vkDestroyImageView(device, _textureCubeView, nullptr);
 	vkDestroyImage(device, _textureCubeImage, nullptr);
-	vkFreeMemory(device, _textureCubeMemory, nullptr);
+	MemoryAllocator::free(_textureCubeMemory);
 	
 	vkDestroyBuffer(device, _vertexBuffer, nullptr);
-	vkFreeMemory(device, _vertexBufferMemory, nullptr);
+	MemoryAllocator::free(_vertexBufferMemory);
 	vkDestroyBuffer(device, _indexBuffer, nullptr);
-	vkFreeMemory(device, _indexBufferMemory, nullptr);
+	MemoryAllocator::free(_indexBufferMemory);
 }
 
 
@@ -11,6 +11,10 @@
 
 #include "common.hpp"
 #include "resources/MeshUtilities.hpp"
+#include "resources/MeshCache.hpp"
+#include "MipmapGenerator.hpp"
+#include "UploadContext.hpp"
+#include "Defragmenter.hpp"
 
 class Skybox {
 public:
@@ -19,7 +23,14 @@ public:
 	
 	~Skybox();
 	
-	void upload(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue);
+	/// Load the mesh and decode the faces in a staging buffer, can be called from any thread.
+	void load(const VkDevice & device, const MeshUtilities::VertexFormat format);
+	
+	/// Create the GPU buffers and cubemap from the loaded data, then release it. The cubemap levels are generated at the next flush of the generator.
+	void upload(const VkDevice & device, UploadContext & upload, MipmapGenerator & mipmaps);
+
+	/// Move the geometry buffers out of the memory blocks being evacuated, within the defragmenter budget.
+	void defragment(VkCommandBuffer & commandBuffer, Defragmenter & defragmenter);
 
 	void clean(VkDevice & device);
 	
@@ -28,9 +39,9 @@ public:
 	const VkDescriptorSet & descriptorSet(const int i){ return _descriptorSets[i]; }
 	
 	
-	VkBuffer _vertexBuffer;
-	VkBuffer _indexBuffer;
-	uint32_t _count;
+	VkBuffer _vertexBuffer = VK_NULL_HANDLE;
+	VkBuffer _indexBuffer = VK_NULL_HANDLE;
+	uint32_t _count = 0;
 	ObjectInfos infos;
 	
 	static VkDescriptorSetLayout createDescriptorSetLayout(const VkDevice & device, const VkSampler & sampler);
@@ -42,12 +53,22 @@ private:
 	
 	std::string _name;
 	
+	// Data prepared by load(), released by upload().
+	std::shared_ptr<MeshCache> _mesh;
+	std::vector<CompactVertex> _compactVertices;
+	VkBuffer _stagingBuffer;
+	MemoryAllocator::Allocation _stagingBufferMemory;
+	unsigned int _texWidth = 0;
+	unsigned int _texHeight = 0;
+	
 	VkImage _textureCubeImage;
 	VkImageView _textureCubeView;
 	
-	VkDeviceMemory _vertexBufferMemory;
-	VkDeviceMemory _indexBufferMemory;
-	VkDeviceMemory _textureCubeMemory;
+	MemoryAllocator::Allocation _vertexBufferMemory;
+	MemoryAllocator::Allocation _indexBufferMemory;
+	VkDeviceSize _vertexBufferSize = 0;
+	VkDeviceSize _indexBufferSize = 0;
+	MemoryAllocator::Allocation _textureCubeMemory;
 	std::vector<VkDescriptorSet> _descriptorSets;
 	
 	
@@ -18,12 +18,20 @@ Swapchain::Swapchain(VkInstance & instance, VkSurfaceKHR & surface, const int wi
 	/// Setup logical device.
 	// Queue setup.
 	VulkanUtilities::ActiveQueues queues = VulkanUtilities::getGraphicsQueueFamilyIndex(physicalDevice, surface);
+	queueFamilies = queues;
 	std::set<int> uniqueQueueFamilies = queues.getIndices();
 	// Device features we want.
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
+	// Block compressed textures when available.
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	compressedTextures = supportedFeatures.textureCompressionBC == VK_TRUE;
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
 	/// Create the logical device.
 	VulkanUtilities::createDevice(physicalDevice, uniqueQueueFamilies, deviceFeatures, device);
+	/// Buffers and images are placed in shared memory blocks.
+	MemoryAllocator::init(physicalDevice, device);
 	/// Get references to the queues.
 	vkGetDeviceQueue(device, queues.graphicsQueue, 0, &graphicsQueue);
 	vkGetDeviceQueue(device, queues.presentQueue, 0, &_presentQueue);
@@ -36,6 +44,22 @@ Swapchain::Swapchain(VkInstance & instance, VkSurfaceKHR & surface, const int wi
 	if(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
 		std::cerr << "Unable to create command pool." << std::endl;
 	}
+	// Uploads run on their own queue when possible.
+	if(queues.transferQueue >= 0){
+		vkGetDeviceQueue(device, queues.transferQueue, 0, &transferQueue);
+		VkCommandPoolCreateInfo transferPoolInfo = {};
+		transferPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		transferPoolInfo.queueFamilyIndex = queues.transferQueue;
+		transferPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		if(vkCreateCommandPool(device, &transferPoolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
+			std::cerr << "Unable to create transfer command pool." << std::endl;
+		}
+		std::cout << "Uploads on transfer queue family " << queues.transferQueue << "." << std::endl;
+	} else {
+		transferQueue = graphicsQueue;
+		transferCommandPool = commandPool;
+		std::cout << "Uploads on the graphics queue." << std::endl;
+	}
 	
 	setup(width, height);
 	
@@ -77,7 +101,7 @@ void Swapchain::setup(const int width, const int height) {
 	
 	/// Create depth buffer.
 	VkFormat depthFormat = VulkanUtilities::findDepthFormat(physicalDevice);
-	VulkanUtilities::createImage(physicalDevice, device, parameters.extent.width, parameters.extent.height, 1, depthFormat , VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, _depthImage, _depthImageMemory);
+	VulkanUtilities::createImage(device, parameters.extent.width, parameters.extent.height, 1, depthFormat , VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, _depthImage, _depthImageMemory);
 	_depthImageView = VulkanUtilities::createImageView(device, _depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, false, 1);
 	VulkanUtilities::transitionImageLayout(device, commandPool, graphicsQueue, _depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, false, 1);
 	
@@ -246,7 +270,11 @@ void Swapchain::clean(){
 		vkDestroySemaphore(device, _imageAvailableSemaphores[i], nullptr);
 		vkDestroyFence(device, _inFlightFences[i], nullptr);
 	}
+	if(transferCommandPool != commandPool){
+		vkDestroyCommandPool(device, transferCommandPool, nullptr);
+	}
 	vkDestroyCommandPool(device, commandPool, nullptr);
+	MemoryAllocator::clean();
 	vkDestroyDevice(device, nullptr);
 }
 
@@ -262,6 +290,6 @@ void Swapchain::unsetup() {
 		vkDestroyImageView(device, _swapchainImageViews[i], nullptr);
 	}
 	vkDestroyImage(device, _depthImage, nullptr);
-	vkFreeMemory(device, _depthImageMemory, nullptr);
+	MemoryAllocator::free(_depthImageMemory);
 	vkDestroySwapchainKHR(device, _swapchain, nullptr);
 }
@@ -40,6 +40,12 @@ public:
 	VkDevice device;
 	VkCommandPool commandPool;
 	VkQueue graphicsQueue;
+	/// Queue and pool for uploads, the graphics ones if the device has no dedicated transfer queue.
+	VkCommandPool transferCommandPool;
+	VkQueue transferQueue;
+	VulkanUtilities::ActiveQueues queueFamilies;
+	/// Are BC1 and BC5 textures supported by the device.
+	bool compressedTextures;
 	
 	uint32_t imageIndex;
 	VkRenderPass finalRenderPass;
@@ -61,7 +67,7 @@ private:
 	std::vector<VkImageView> _swapchainImageViews;
 	std::vector<VkFramebuffer> _swapchainFramebuffers;
 	VkImage _depthImage;
-	VkDeviceMemory _depthImageMemory;
+	MemoryAllocator::Allocation _depthImageMemory;
 	VkImageView _depthImageView;
 	
 	std::vector<VkSemaphore> _imageAvailableSemaphores;
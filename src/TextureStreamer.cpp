@@ -0,0 +1,271 @@
+#include "TextureStreamer.hpp"
+#include "VulkanUtilities.hpp"
+
+#include <algorithm>
+#include <array>
+
+// Level offsets in the staging buffer, a multiple of all texel block sizes.
+static VkDeviceSize alignStaging(const VkDeviceSize offset){
+	return (offset + 15) & ~VkDeviceSize(15);
+}
+
+void TextureStreamer::init(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const uint32_t count){
+	_physicalDevice = physicalDevice;
+	_device = device;
+	_count = std::max(1u, count);
+	_stagings.resize(_count);
+}
+
+std::shared_ptr<TextureStreamer::Texture> TextureStreamer::add(const std::shared_ptr<TextureCache> & cache, UploadContext & upload){
+	auto texture = std::make_shared<Texture>();
+	if(!cache || !cache->valid()){
+		return texture;
+	}
+	texture->_cache = cache;
+	// Coarsest levels, small enough to always stay resident.
+	uint32_t tail = 0;
+	while(tail + 1 < cache->levelsCount() && (std::max(cache->width(), cache->height()) >> tail) > tailSize){
+		++tail;
+	}
+	VulkanUtilities::createTexture(*cache, tail, _physicalDevice, _device, upload, texture->_image, texture->_memory, texture->_view);
+	texture->_size = texture->_memory.size;
+	MemoryAllocator::setMovable(texture->_memory);
+	texture->_residentLevel = tail;
+	texture->_tailLevel = tail;
+	texture->_wantedLevel = tail;
+	_residentSize += texture->_size;
+	_textures.push_back(texture);
+	return texture;
+}
+
+void TextureStreamer::request(Texture & texture, const float pixels){
+	if(!texture._cache){
+		return;
+	}
+	// Coarsest level still having at least one texel per pixel.
+	const uint32_t size = std::max(texture._cache->width(), texture._cache->height());
+	uint32_t level = 0;
+	while(level < texture._tailLevel && float(size >> (level + 1)) >= pixels){
+		++level;
+	}
+	texture._wantedLevel = std::min(texture._wantedLevel, level);
+	texture._priority = std::max(texture._priority, pixels);
+}
+
+VkDeviceSize TextureStreamer::levelsSize(const Texture & texture, const uint32_t first, const uint32_t last){
+	VkDeviceSize size = 0;
+	for(uint32_t lid = first; lid < last; ++lid){
+		size += alignStaging(texture._cache->level(lid).size);
+	}
+	return size;
+}
+
+void TextureStreamer::update(VkCommandBuffer & commandBuffer){
+	// The frame using a staging buffer or a retired image was submitted _count frames ago, its fence has been waited on.
+	_retired.erase(std::remove_if(_retired.begin(), _retired.end(), [this](const Retired & retired){
+		if(retired.frame + _count > _frame){
+			return false;
+		}
+		vkDestroyImageView(_device, retired.view, nullptr);
+		vkDestroyImage(_device, retired.image, nullptr);
+		MemoryAllocator::Allocation memory = retired.memory;
+		MemoryAllocator::free(memory);
+		return true;
+	}), _retired.end());
+
+	// Most visible textures first.
+	std::vector<Texture *> textures;
+	for(auto & texture : _textures){
+		textures.push_back(texture.get());
+	}
+	std::stable_sort(textures.begin(), textures.end(), [](const Texture * a, const Texture * b){
+		return a->_priority > b->_priority;
+	});
+
+	// Over budget, drop the levels of the least visible textures that are finer than needed.
+	std::vector<std::pair<Texture *, uint32_t>> resizes;
+	VkDeviceSize plannedSize = _residentSize;
+	for(auto it = textures.rbegin(); it != textures.rend() && plannedSize > _residentBudget; ++it){
+		Texture & texture = **it;
+		if(texture._residentLevel < texture._wantedLevel){
+			plannedSize -= std::min(plannedSize, levelsSize(texture, texture._residentLevel, texture._wantedLevel));
+			resizes.emplace_back(&texture, texture._wantedLevel);
+		}
+	}
+
+	// Then stream the missing levels of the most visible textures, coarsest first, within both budgets.
+	// A level larger than the upload budget is streamed alone.
+	VkDeviceSize uploadSize = 0;
+	for(Texture * texture : textures){
+		if(texture->_priority <= 0.0f){
+			break;
+		}
+		uint32_t level = texture->_residentLevel;
+		while(level > texture->_wantedLevel){
+			const VkDeviceSize size = levelsSize(*texture, level - 1, level);
+			if((uploadSize > 0 && uploadSize + size > _uploadBudget) || plannedSize + size > _residentBudget){
+				break;
+			}
+			uploadSize += size;
+			plannedSize += size;
+			--level;
+		}
+		if(level < texture->_residentLevel){
+			resizes.emplace_back(texture, level);
+		}
+	}
+
+	if(!resizes.empty()){
+		Staging & staging = _stagings[_frame % _count];
+		reserve(staging, uploadSize);
+		VkDeviceSize offset = 0;
+		for(const auto & resize : resizes){
+			this->resize(commandBuffer, *resize.first, resize.second, staging, offset);
+		}
+	}
+
+	// Requests are made again for each frame.
+	for(auto & texture : _textures){
+		texture->_wantedLevel = texture->_tailLevel;
+		texture->_priority = 0.0f;
+	}
+	++_frame;
+}
+
+void TextureStreamer::defragment(VkCommandBuffer & commandBuffer, Defragmenter & defragmenter){
+	Staging & staging = _stagings[_frame % _count];
+	for(auto & texture : _textures){
+		if(MemoryAllocator::evacuating(texture->_memory) && defragmenter.consume(texture->_size)){
+			// Same levels, all copied from the current image.
+			VkDeviceSize offset = 0;
+			resize(commandBuffer, *texture, texture->_residentLevel, staging, offset);
+		}
+	}
+}
+
+void TextureStreamer::reserve(Staging & staging, const VkDeviceSize size){
+	if(size == 0 || staging.size >= size){
+		return;
+	}
+	// The previous buffer is not used anymore by the frame owning it.
+	if(staging.buffer != VK_NULL_HANDLE){
+		vkDestroyBuffer(_device, staging.buffer, nullptr);
+		MemoryAllocator::free(staging.memory);
+	}
+	staging.size = std::max(size, _uploadBudget);
+	VulkanUtilities::createBuffer(_device, staging.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staging.buffer, staging.memory);
+	staging.data = staging.memory.data;
+}
+
+void TextureStreamer::resize(VkCommandBuffer & commandBuffer, Texture & texture, const uint32_t level, Staging & staging, VkDeviceSize & offset){
+	const TextureCache & cache = *texture._cache;
+	const uint32_t oldCount = cache.levelsCount() - texture._residentLevel;
+	const uint32_t newCount = cache.levelsCount() - level;
+	VkImage image;
+	MemoryAllocator::Allocation memory;
+	VulkanUtilities::createImage(_device, std::max(1u, cache.width() >> level), std::max(1u, cache.height() >> level), newCount, cache.format(), VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, image, memory);
+	MemoryAllocator::setMovable(memory);
+
+	// The new image receives the copies, the old one is read after the previous frames sampled it.
+	std::array<VkImageMemoryBarrier, 2> barriers = {};
+	for(auto & barrier : barriers){
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+	}
+	barriers[0].image = image;
+	barriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[0].srcAccessMask = 0;
+	barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[0].subresourceRange.levelCount = newCount;
+	barriers[1].image = texture._image;
+	barriers[1].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barriers[1].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	barriers[1].subresourceRange.levelCount = oldCount;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+	// Levels present in both images.
+	const uint32_t first = std::max(level, texture._residentLevel);
+	std::vector<VkImageCopy> copies;
+	for(uint32_t lid = first; lid < cache.levelsCount(); ++lid){
+		VkImageCopy copy = {};
+		copy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copy.srcSubresource.mipLevel = lid - texture._residentLevel;
+		copy.srcSubresource.baseArrayLayer = 0;
+		copy.srcSubresource.layerCount = 1;
+		copy.dstSubresource = copy.srcSubresource;
+		copy.dstSubresource.mipLevel = lid - level;
+		copy.extent = { std::max(1u, cache.width() >> lid), std::max(1u, cache.height() >> lid), 1 };
+		copies.push_back(copy);
+	}
+	vkCmdCopyImage(commandBuffer, texture._image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copies.size()), copies.data());
+
+	// Streamed levels, through the staging buffer of the frame.
+	std::vector<VkBufferImageCopy> regions;
+	for(uint32_t lid = level; lid < texture._residentLevel; ++lid){
+		const TextureCache::Level & source = cache.level(lid);
+		memcpy(staging.data + offset, cache.data() + source.offset, size_t(source.size));
+		VkBufferImageCopy region = {};
+		region.bufferOffset = offset;
+		region.bufferRowLength = 0; // Tightly packed.
+		region.bufferImageHeight = 0; // Tightly packed.
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = lid - level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = {0, 0, 0};
+		region.imageExtent = { std::max(1u, cache.width() >> lid), std::max(1u, cache.height() >> lid), 1 };
+		regions.push_back(region);
+		offset = alignStaging(offset + source.size);
+	}
+	if(!regions.empty()){
+		vkCmdCopyBufferToImage(commandBuffer, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+	}
+
+	VkImageMemoryBarrier barrier = barriers[0];
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	// Swap the images, the old one can still be used by the frames in flight.
+	_retired.push_back({ texture._image, texture._memory, texture._view, _frame });
+	_residentSize = _residentSize - texture._size + memory.size;
+	texture._image = image;
+	texture._memory = memory;
+	texture._view = VulkanUtilities::createImageView(_device, image, cache.format(), VK_IMAGE_ASPECT_COLOR_BIT, false, newCount);
+	texture._size = memory.size;
+	texture._residentLevel = level;
+}
+
+void TextureStreamer::clean(){
+	for(Retired & retired : _retired){
+		vkDestroyImageView(_device, retired.view, nullptr);
+		vkDestroyImage(_device, retired.image, nullptr);
+		MemoryAllocator::free(retired.memory);
+	}
+	_retired.clear();
+	for(auto & texture : _textures){
+		vkDestroyImageView(_device, texture->_view, nullptr);
+		vkDestroyImage(_device, texture->_image, nullptr);
+		MemoryAllocator::free(texture->_memory);
+		texture->_cache.reset();
+	}
+	_textures.clear();
+	for(Staging & staging : _stagings){
+		if(staging.buffer != VK_NULL_HANDLE){
+			vkDestroyBuffer(_device, staging.buffer, nullptr);
+			MemoryAllocator::free(staging.memory);
+		}
+	}
+	_stagings.clear();
+	_residentSize = 0;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "common.hpp"
+#include "resources/TextureCache.hpp"
+#include "UploadContext.hpp"
+#include "Defragmenter.hpp"
+#include <memory>
+
+/// Residency manager for the cooked textures. Only the small levels are uploaded when a texture is added,
+/// higher resolution levels are streamed in over the following frames, within a per frame upload budget,
+/// and the top levels of textures not visible or far away are dropped when over the memory budget.
+class TextureStreamer {
+public:
+
+	/// Levels whose largest dimension is at most this size are always resident.
+	static const uint32_t tailSize = 64;
+
+	/// A streamed texture: the image and its view are replaced when levels are added or dropped.
+	struct Texture {
+
+		const VkImageView & view() const { return _view; }
+
+		/// Finest level of the cache currently in the image.
+		uint32_t residentLevel() const { return _residentLevel; }
+
+		// Kept mapped for the levels still to stream.
+		std::shared_ptr<TextureCache> _cache;
+		VkImage _image = VK_NULL_HANDLE;
+		MemoryAllocator::Allocation _memory;
+		VkImageView _view = VK_NULL_HANDLE;
+		VkDeviceSize _size = 0;
+		uint32_t _residentLevel = 0;
+		uint32_t _tailLevel = 0;
+		// Finest level needed, and size on screen in pixels, for the current frame.
+		uint32_t _wantedLevel = 0;
+		float _priority = 0.0f;
+	};
+
+	/// The number of frames in flight bounds the lifetime of the staging buffers and of the replaced images.
+	void init(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const uint32_t count);
+
+	/// Upload the tail levels of a cached texture and register it for streaming.
+	std::shared_ptr<Texture> add(const std::shared_ptr<TextureCache> & cache, UploadContext & upload);
+
+	/// Request a texture for the current frame, for a surface covering the given size on screen in pixels.
+	void request(Texture & texture, const float pixels);
+
+	/// Record the transfers for the current frame in a command buffer, before any render pass.
+	/// Requests are reset afterwards, textures not requested again are candidates for eviction.
+	void update(VkCommandBuffer & commandBuffer);
+
+	/// Move the images out of the memory blocks being evacuated, within the defragmenter budget. Call after update.
+	void defragment(VkCommandBuffer & commandBuffer, Defragmenter & defragmenter);
+
+	/// Device memory used by the streamed textures, in bytes.
+	VkDeviceSize residentSize() const { return _residentSize; }
+
+	void budgets(const VkDeviceSize residentBudget, const VkDeviceSize uploadBudget){ _residentBudget = residentBudget; _uploadBudget = uploadBudget; }
+
+	void clean();
+
+private:
+
+	/// Image replaced by a resize, destroyed once the frames that could use it are done.
+	struct Retired {
+		VkImage image;
+		MemoryAllocator::Allocation memory;
+		VkImageView view;
+		uint64_t frame;
+	};
+
+	/// Host visible buffer used by one frame in flight.
+	struct Staging {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocator::Allocation memory;
+		char * data = nullptr;
+		VkDeviceSize size = 0;
+	};
+
+	/// Size of levels first to last - 1 of a texture once uploaded, with the staging alignment.
+	static VkDeviceSize levelsSize(const Texture & texture, const uint32_t first, const uint32_t last);
+
+	/// Replace the image of a texture by one starting at the given level. Existing levels are copied from the old image,
+	/// missing ones from the staging buffer starting at the given offset, which is advanced.
+	void resize(VkCommandBuffer & commandBuffer, Texture & texture, const uint32_t level, Staging & staging, VkDeviceSize & offset);
+
+	/// Ensure the staging buffer of the frame can hold the given size.
+	void reserve(Staging & staging, const VkDeviceSize size);
+
+	VkPhysicalDevice _physicalDevice = VK_NULL_HANDLE;
+	VkDevice _device = VK_NULL_HANDLE;
+	uint32_t _count = 1;
+	uint64_t _frame = 0;
+
+	std::vector<std::shared_ptr<Texture>> _textures;
+	std::vector<Retired> _retired;
+	std::vector<Staging> _stagings;
+
+	VkDeviceSize _residentSize = 0;
+	VkDeviceSize _residentBudget = VkDeviceSize(256) << 20;
+	VkDeviceSize _uploadBudget = VkDeviceSize(4) << 20;
+};
@@ -0,0 +1,156 @@
+#include "ThreadUtilities.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+	/// Ranges of a parallelFor call, claimed one at a time by the pool workers and by the waiting threads.
+	struct Batch {
+		const std::function<void(unsigned int, size_t, size_t)> * func;
+		size_t count;
+		unsigned int rangeCount;
+		unsigned int next;
+		unsigned int done;
+		std::exception_ptr exception;
+	};
+
+	/// Persistent workers shared by all calls, nested calls included: a thread waiting for its ranges processes pending ones instead of sleeping.
+	class ThreadPool {
+	public:
+
+		~ThreadPool(){
+			stop();
+		}
+
+		/// Start the workers if needed, the calling thread being the remaining one.
+		void start(unsigned int threads){
+			std::lock_guard<std::mutex> lock(_mutex);
+			if(!_workers.empty() || threads < 2){
+				return;
+			}
+			_stopping = false;
+			for(unsigned int tid = 1; tid < threads; ++tid){
+				_workers.emplace_back(&ThreadPool::work, this);
+			}
+		}
+
+		/// Join the workers, no parallelFor call should be in flight.
+		void stop(){
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stopping = true;
+			}
+			_condition.notify_all();
+			for(auto & worker : _workers){
+				worker.join();
+			}
+			_workers.clear();
+		}
+
+		/// Queue the ranges of the batch, process them with the workers and wait for all of them.
+		void run(Batch & batch){
+			std::unique_lock<std::mutex> lock(_mutex);
+			_batches.push_back(&batch);
+			_condition.notify_all();
+			// Start with our own ranges, then help with the others until ours are done.
+			while(batch.done < batch.rangeCount){
+				Batch * current = (batch.next < batch.rangeCount) ? &batch : (_batches.empty() ? nullptr : _batches.front());
+				if(current == nullptr){
+					_condition.wait(lock);
+					continue;
+				}
+				process(*current, lock);
+			}
+		}
+
+	private:
+
+		void work(){
+			std::unique_lock<std::mutex> lock(_mutex);
+			while(true){
+				_condition.wait(lock, [this]{ return _stopping || !_batches.empty(); });
+				if(_stopping){
+					return;
+				}
+				process(*_batches.front(), lock);
+			}
+		}
+
+		/// Claim a range of the batch and process it unlocked. The batch stays alive until its last range is done.
+		void process(Batch & batch, std::unique_lock<std::mutex> & lock){
+			const unsigned int rid = batch.next++;
+			if(batch.next == batch.rangeCount){
+				_batches.erase(std::find(_batches.begin(), _batches.end(), &batch));
+			}
+			lock.unlock();
+			std::exception_ptr exception;
+			try {
+				(*batch.func)(rid, batch.count * rid / batch.rangeCount, batch.count * (rid + 1) / batch.rangeCount);
+			} catch(...){
+				exception = std::current_exception();
+			}
+			lock.lock();
+			if(exception && !batch.exception){
+				batch.exception = exception;
+			}
+			if(++batch.done == batch.rangeCount){
+				_condition.notify_all();
+			}
+		}
+
+		std::vector<std::thread> _workers;
+		std::deque<Batch *> _batches;
+		std::mutex _mutex;
+		std::condition_variable _condition;
+		bool _stopping = false;
+	};
+
+	ThreadPool & threadPool(){
+		static ThreadPool pool;
+		return pool;
+	}
+
+}
+
+unsigned int ThreadUtilities::_threadCount = 0;
+
+unsigned int ThreadUtilities::threadCount(){
+	if(_threadCount > 0){
+		return _threadCount;
+	}
+	// The hardware concurrency can be unknown, in which case we stay on a single thread.
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+void ThreadUtilities::setThreadCount(unsigned int count){
+	if(count != _threadCount){
+		// The workers are restarted with the new count at the next parallel call.
+		threadPool().stop();
+	}
+	_threadCount = count;
+}
+
+unsigned int ThreadUtilities::parallelFor(size_t count, unsigned int threads, const std::function<void(unsigned int, size_t, size_t)> & func){
+	if(count == 0){
+		return 0;
+	}
+	const unsigned int rangeCount = (unsigned int)std::max(size_t(1), std::min(size_t(threads), count));
+	if(rangeCount == 1){
+		func(0, 0, count);
+		return 1;
+	}
+	// The ranges are processed by at most threadCount() threads, whatever the nesting.
+	threadPool().start(threadCount());
+	Batch batch = { &func, count, rangeCount, 0, 0, nullptr };
+	threadPool().run(batch);
+	if(batch.exception){
+		std::rethrow_exception(batch.exception);
+	}
+	return rangeCount;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <functional>
+#include <cstddef>
+
+class ThreadUtilities {
+public:
+	
+	/// Number of threads to use for parallel work, derived from the hardware unless overriden.
+	static unsigned int threadCount();
+	
+	/// Override the number of threads (0 to use the hardware concurrency), no parallel work should be in flight.
+	static void setThreadCount(unsigned int count);
+	
+	/// Split [0, count) in at most 'threads' contiguous ranges and process them in parallel.
+	/// The function receives the range index, its first and past-the-end elements. Returns the number of ranges.
+	/// Ranges are processed by a persistent pool of threadCount() threads, nested calls included. Exceptions are rethrown once all ranges are done.
+	static unsigned int parallelFor(size_t count, unsigned int threads, const std::function<void(unsigned int, size_t, size_t)> & func);
+	
+private:
+	
+	static unsigned int _threadCount;
+};
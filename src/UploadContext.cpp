@@ -0,0 +1,236 @@
+#include "UploadContext.hpp"
+#include "VulkanUtilities.hpp"
+
+#include <limits>
+
+UploadContext::UploadContext(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VulkanUtilities::ActiveQueues & families, const VkCommandPool & graphicsPool, const VkQueue & graphicsQueue, const VkCommandPool & transferPool, const VkQueue & transferQueue, const VkDeviceSize size) : _physicalDevice(physicalDevice), _device(device), _graphicsPool(graphicsPool), _graphicsQueue(graphicsQueue), _transferPool(transferPool), _transferQueue(transferQueue), _size(size) {
+	_graphicsFamily = uint32_t(families.graphicsQueue);
+	_transferFamily = families.transferQueue >= 0 ? uint32_t(families.transferQueue) : _graphicsFamily;
+	// Host visible memory is persistently mapped by the allocator.
+	VulkanUtilities::createBuffer(_device, _size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, _buffer, _memory);
+	_data = _memory.data;
+	// On unified memory architectures, the main device local heap is also host visible: write there directly.
+	// Discrete devices can expose host visible device memory (resizable BAR), but host writes then cross the bus
+	// and linear images are slower to sample: keep the staging copies for them.
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(_physicalDevice, &deviceProperties);
+	const bool unified = deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU || deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+	VkPhysicalDeviceMemoryProperties properties;
+	vkGetPhysicalDeviceMemoryProperties(_physicalDevice, &properties);
+	int heap = -1;
+	for(uint32_t hid = 0; hid < properties.memoryHeapCount; ++hid){
+		if((properties.memoryHeaps[hid].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && (heap < 0 || properties.memoryHeaps[hid].size > properties.memoryHeaps[heap].size)){
+			heap = int(hid);
+		}
+	}
+	const VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	for(uint32_t tid = 0; unified && tid < properties.memoryTypeCount; ++tid){
+		if(int(properties.memoryTypes[tid].heapIndex) == heap && (properties.memoryTypes[tid].propertyFlags & flags) == flags){
+			_direct = true;
+			break;
+		}
+	}
+	if(_direct){
+		std::cout << "Direct uploads to host visible device memory (heap " << heap << ", " << (properties.memoryHeaps[heap].size >> 20) << " MB)." << std::endl;
+	} else {
+		std::cout << "Uploads through staging buffers." << std::endl;
+	}
+}
+
+UploadContext::Allocation UploadContext::allocate(const VkDeviceSize size, const VkDeviceSize alignment){
+	if(size > _size){
+		// Dedicated buffer, released with the current batch.
+		Allocation allocation = { VK_NULL_HANDLE, 0, nullptr };
+		MemoryAllocator::Allocation memory;
+		VulkanUtilities::createBuffer(_device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, allocation.buffer, memory);
+		allocation.data = memory.data;
+		_current.buffers.emplace_back(allocation.buffer, memory);
+		return allocation;
+	}
+	VkDeviceSize begin = (_head + alignment - 1) / alignment * alignment;
+	// Allocations don't wrap around the end of the ring.
+	if(begin / _size != (begin + size - 1) / _size){
+		begin = (begin / _size + 1) * _size;
+	}
+	// Free the space used by previous submissions, the pending commands have to be submitted if they hold it.
+	while(begin + size - _tail > _size){
+		if(_submitted.empty()){
+			submit();
+		}
+		if(_submitted.empty()){
+			// The whole ring is free, start again at its beginning.
+			begin = (_head + _size - 1) / _size * _size;
+			_tail = begin;
+			break;
+		}
+		retire();
+	}
+	_head = begin + size;
+	_current.end = _head;
+	return { _buffer, begin % _size, _data + (begin % _size) };
+}
+
+UploadContext::Allocation UploadContext::stage(const void * data, const VkDeviceSize size, const VkDeviceSize alignment){
+	const Allocation allocation = allocate(size, alignment);
+	memcpy(allocation.data, data, size_t(size));
+	return allocation;
+}
+
+VkCommandBuffer & UploadContext::transferCommandBuffer(){
+	if(_current.transferCommandBuffer == VK_NULL_HANDLE){
+		_current.transferCommandBuffer = VulkanUtilities::beginOneShotCommandBuffer(_device, _transferPool);
+	}
+	return _current.transferCommandBuffer;
+}
+
+VkCommandBuffer & UploadContext::graphicsCommandBuffer(){
+	if(_current.graphicsCommandBuffer == VK_NULL_HANDLE){
+		_current.graphicsCommandBuffer = VulkanUtilities::beginOneShotCommandBuffer(_device, _graphicsPool);
+	}
+	return _current.graphicsCommandBuffer;
+}
+
+void UploadContext::releaseBuffer(const VkBuffer & buffer, const VkPipelineStageFlags stages, const VkAccessFlags access){
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = dedicated() ? _transferFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = dedicated() ? _graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	// Release on the transfer queue, then acquire on the graphics queue.
+	if(dedicated()){
+		vkCmdPipelineBarrier(transferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		barrier.srcAccessMask = 0;
+	}
+	barrier.dstAccessMask = access;
+	vkCmdPipelineBarrier(graphicsCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, stages, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void UploadContext::releaseImage(const VkImage & image, const VkImageLayout oldLayout, const VkImageLayout newLayout, const uint32_t mipCount, const uint32_t layerCount, const VkPipelineStageFlags stages, const VkAccessFlags access){
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = dedicated() ? _transferFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = dedicated() ? _graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipCount;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = layerCount;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	// Both halves of the ownership transfer perform the same layout transition.
+	if(dedicated()){
+		vkCmdPipelineBarrier(transferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		barrier.srcAccessMask = 0;
+	}
+	barrier.dstAccessMask = access;
+	vkCmdPipelineBarrier(graphicsCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, stages, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void UploadContext::release(const VkBuffer & buffer, const MemoryAllocator::Allocation & memory){
+	_current.buffers.emplace_back(buffer, memory);
+}
+
+void UploadContext::submit(){
+	if(_current.transferCommandBuffer == VK_NULL_HANDLE && _current.graphicsCommandBuffer == VK_NULL_HANDLE){
+		// Nothing recorded, released buffers wait for the previous submission.
+		if(_submitted.empty()){
+			_tail = _head;
+			for(auto & buffer : _current.buffers){
+				vkDestroyBuffer(_device, buffer.first, nullptr);
+				MemoryAllocator::free(buffer.second);
+			}
+		} else {
+			_submitted.back().buffers.insert(_submitted.back().buffers.end(), _current.buffers.begin(), _current.buffers.end());
+			_submitted.back().end = _head;
+		}
+		_current = Batch();
+		return;
+	}
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	if(vkCreateFence(_device, &fenceInfo, nullptr, &_current.fence) != VK_SUCCESS){
+		std::cerr << "Unable to create upload fence." << std::endl;
+	}
+	const bool graphics = _current.graphicsCommandBuffer != VK_NULL_HANDLE;
+	// Copies first, the graphics queue waits for them if they run on another queue.
+	if(_current.transferCommandBuffer != VK_NULL_HANDLE){
+		vkEndCommandBuffer(_current.transferCommandBuffer);
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &_current.transferCommandBuffer;
+		if(graphics && dedicated()){
+			VkSemaphoreCreateInfo semaphoreInfo = {};
+			semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			if(vkCreateSemaphore(_device, &semaphoreInfo, nullptr, &_current.semaphore) != VK_SUCCESS){
+				std::cerr << "Unable to create upload semaphore." << std::endl;
+			}
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &_current.semaphore;
+		}
+		if(vkQueueSubmit(_transferQueue, 1, &submitInfo, graphics ? VK_NULL_HANDLE : _current.fence) != VK_SUCCESS){
+			std::cerr << "Unable to submit uploads." << std::endl;
+		}
+	}
+	if(graphics){
+		vkEndCommandBuffer(_current.graphicsCommandBuffer);
+		const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		VkSubmitInfo submitInfo = {};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &_current.graphicsCommandBuffer;
+		if(_current.semaphore != VK_NULL_HANDLE){
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &_current.semaphore;
+			submitInfo.pWaitDstStageMask = &waitStage;
+		}
+		if(vkQueueSubmit(_graphicsQueue, 1, &submitInfo, _current.fence) != VK_SUCCESS){
+			std::cerr << "Unable to submit uploads." << std::endl;
+		}
+	}
+	_current.end = _head;
+	_submitted.push_back(_current);
+	_current = Batch();
+	++_submissionsCount;
+}
+
+void UploadContext::retire(){
+	Batch & batch = _submitted.front();
+	// The fence is signaled after the last submission of the batch, which follows or waits for the other one.
+	vkWaitForFences(_device, 1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	vkDestroyFence(_device, batch.fence, nullptr);
+	if(batch.semaphore != VK_NULL_HANDLE){
+		vkDestroySemaphore(_device, batch.semaphore, nullptr);
+	}
+	if(batch.transferCommandBuffer != VK_NULL_HANDLE){
+		vkFreeCommandBuffers(_device, _transferPool, 1, &batch.transferCommandBuffer);
+	}
+	if(batch.graphicsCommandBuffer != VK_NULL_HANDLE){
+		vkFreeCommandBuffers(_device, _graphicsPool, 1, &batch.graphicsCommandBuffer);
+	}
+	for(auto & buffer : batch.buffers){
+		vkDestroyBuffer(_device, buffer.first, nullptr);
+		MemoryAllocator::free(buffer.second);
+	}
+	_tail = batch.end;
+	_submitted.erase(_submitted.begin());
+}
+
+void UploadContext::finish(){
+	submit();
+	while(!_submitted.empty()){
+		retire();
+	}
+	_tail = _head;
+}
+
+void UploadContext::clean(){
+	finish();
+	vkDestroyBuffer(_device, _buffer, nullptr);
+	MemoryAllocator::free(_memory);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "common.hpp"
+#include "VulkanUtilities.hpp"
+
+/// Batch uploads: data is copied in a persistently mapped staging ring, and the copies and layout transitions
+/// are recorded in a shared command buffer. Submissions are fenced, and the ring space they use is recycled
+/// once their fence is signaled, a full ring triggering a submission instead of a wait for the queue to be idle.
+/// Copies run on the transfer queue when the device has one, the resources are then handed to the graphics queue,
+/// whose command buffer also receives the work needing it (mipmaps generation) and waits for the copies.
+/// On integrated and software devices whose largest device local heap is host visible, resources are written directly instead.
+class UploadContext {
+public:
+
+	/// Default size of the staging ring.
+	static const VkDeviceSize defaultSize = VkDeviceSize(32) << 20;
+
+	/// Staging space, at an offset in a buffer, mapped at data.
+	struct Allocation {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		char * data;
+	};
+
+	/// Without a transfer queue family, the transfer queue and pool are the graphics ones.
+	UploadContext(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VulkanUtilities::ActiveQueues & families, const VkCommandPool & graphicsPool, const VkQueue & graphicsQueue, const VkCommandPool & transferPool, const VkQueue & transferQueue, const VkDeviceSize size = defaultSize);
+
+	UploadContext(const UploadContext &) = delete;
+	UploadContext & operator=(const UploadContext &) = delete;
+
+	/// Reserve staging space, usable by the commands recorded next. This can submit the pending commands if the ring is full,
+	/// so query the command buffers afterwards. Allocations larger than the ring get their own buffer.
+	Allocation allocate(const VkDeviceSize size, const VkDeviceSize alignment = 16);
+
+	/// Copy data in newly reserved staging space.
+	Allocation stage(const void * data, const VkDeviceSize size, const VkDeviceSize alignment = 16);
+
+	/// Command buffer receiving the copies, begun if needed. Only transfer commands are allowed.
+	VkCommandBuffer & transferCommandBuffer();
+
+	/// Command buffer executed on the graphics queue once the copies are done, begun if needed.
+	VkCommandBuffer & graphicsCommandBuffer();
+
+	/// Hand a buffer written by the copies to the graphics queue, for the given stages and accesses.
+	void releaseBuffer(const VkBuffer & buffer, const VkPipelineStageFlags stages, const VkAccessFlags access);
+
+	/// Hand an image written by the copies to the graphics queue, for the given stages and accesses, changing its layout.
+	void releaseImage(const VkImage & image, const VkImageLayout oldLayout, const VkImageLayout newLayout, const uint32_t mipCount, const uint32_t layerCount, const VkPipelineStageFlags stages, const VkAccessFlags access);
+
+	/// Destroy a buffer once the commands recorded so far are complete.
+	void release(const VkBuffer & buffer, const MemoryAllocator::Allocation & memory);
+
+	/// Submit the pending commands, without waiting for them.
+	void submit();
+
+	/// Submit the pending commands and wait for all submissions to complete.
+	void finish();
+
+	/// Can device local resources be written by the host, skipping the staging copies.
+	bool direct() const { return _direct; }
+
+	/// Number of submissions so far.
+	uint32_t submissionsCount() const { return _submissionsCount; }
+
+	void clean();
+
+private:
+
+	/// Recorded commands and the resources they use.
+	struct Batch {
+		VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+		VkCommandBuffer graphicsCommandBuffer = VK_NULL_HANDLE;
+		VkSemaphore semaphore = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		// Ring position after the last allocation of the batch.
+		VkDeviceSize end = 0;
+		std::vector<std::pair<VkBuffer, MemoryAllocator::Allocation>> buffers;
+	};
+
+	/// Wait for the oldest submission, and recycle its resources and ring space.
+	void retire();
+
+	/// Are copies done on a separate queue family.
+	bool dedicated() const { return _transferFamily != _graphicsFamily; }
+
+	VkPhysicalDevice _physicalDevice;
+	VkDevice _device;
+	VkCommandPool _graphicsPool;
+	VkQueue _graphicsQueue;
+	uint32_t _graphicsFamily;
+	VkCommandPool _transferPool;
+	VkQueue _transferQueue;
+	uint32_t _transferFamily;
+	bool _direct = false;
+
+	VkBuffer _buffer = VK_NULL_HANDLE;
+	MemoryAllocator::Allocation _memory;
+	char * _data = nullptr;
+	VkDeviceSize _size = 0;
+	// Ring positions increase continuously, wrapped when accessing the buffer.
+	VkDeviceSize _head = 0;
+	VkDeviceSize _tail = 0;
+
+	Batch _current;
+	std::vector<Batch> _submitted;
+	uint32_t _submissionsCount = 0;
+};
@@ -1,4 +1,7 @@
 #include "VulkanUtilities.hpp"
+#include "resources/TextureCache.hpp"
+#include "MipmapGenerator.hpp"
+#include "UploadContext.hpp"
 #include "resources/Resources.hpp"
 #include "common.hpp"
 
@@ -22,18 +25,22 @@ VkDeviceSize VulkanUtilities::uniformOffset;
 /// Shader modules handling.
 
 VkShaderModule VulkanUtilities::createShaderModule(VkDevice device, const std::string& path) {
-	size_t size = 0;
-	char * data = Resources::loadRawDataFromExternalFile(path, size);
+	// The mapping is page aligned, as required for the opcodes.
+	const MappedFile file(path);
+	if(!file.valid()){
+		std::cerr << "Unable to load shader at path \"" << path << "\"." << std::endl;
+		return VK_NULL_HANDLE;
+	}
 	
 	VkShaderModuleCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = size;
+	createInfo.codeSize = file.size();
 	// We need to cast from char to uint32_t (opcodes).
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(data);
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(file.data());
 	VkShaderModule shaderModule;
 	if(vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
 		std::cerr << "Unable to create shader module." << std::endl;
-		return shaderModule;
+		return VK_NULL_HANDLE;
 	}
 	return shaderModule;
 }
@@ -97,6 +104,16 @@ VulkanUtilities::ActiveQueues VulkanUtilities::getGraphicsQueueFamilyIndex(VkPhy
 
 		++i;
 	}
+	// A family supporting transfers but neither graphics nor compute is usually backed by a dedicated copy engine.
+	// Its copies have to be texel precise, for the small mip levels.
+	for(uint32_t j = 0; j < queueFamilyCount; ++j){
+		const VkQueueFamilyProperties & queueFamily = queueFamilies[j];
+		const VkExtent3D & granularity = queueFamily.minImageTransferGranularity;
+		if(queueFamily.queueCount > 0 && (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && granularity.width == 1 && granularity.height == 1 && granularity.depth == 1){
+			queues.transferQueue = int(j);
+			break;
+		}
+	}
 	return queues;
 }
 
@@ -427,7 +444,7 @@ uint32_t VulkanUtilities::findMemoryType(const uint32_t typeFilter, const VkMemo
 	return 0;
 }
 
-int VulkanUtilities::createBuffer(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkDeviceSize & size, const VkBufferUsageFlags & usage, const VkMemoryPropertyFlags & properties, VkBuffer & buffer, VkDeviceMemory & bufferMemory){
+int VulkanUtilities::createBuffer(const VkDevice & device, const VkDeviceSize & size, const VkBufferUsageFlags & usage, const VkMemoryPropertyFlags & properties, VkBuffer & buffer, MemoryAllocator::Allocation & bufferMemory){
 	// Create buffer.
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -439,19 +456,16 @@ int VulkanUtilities::createBuffer(const VkPhysicalDevice & physicalDevice, const
 		return 3;
 	}
 	
-	// Allocate memory for buffer.
+	// Allocate memory for buffer, in a shared block.
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = VulkanUtilities::findMemoryType(memRequirements.memoryTypeBits, properties, physicalDevice);
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
+	bufferMemory = MemoryAllocator::allocate(memRequirements, properties, false);
+	if (bufferMemory.memory == VK_NULL_HANDLE) {
 		std::cerr << "Failed to allocate buffer." << std::endl;
 		return 3;
 	}
 	// Bind buffer to memory.
-	vkBindBufferMemory(device, buffer, bufferMemory, 0);
+	vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
 	return 0;
 }
 
@@ -484,18 +498,7 @@ void VulkanUtilities::endOneShotCommandBuffer(VkCommandBuffer & commandBuffer, c
 	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 }
 
-void VulkanUtilities::copyBuffer(const VkBuffer & srcBuffer, const VkBuffer & dstBuffer, const VkDeviceSize & size, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & queue){
-	VkCommandBuffer commandBuffer = beginOneShotCommandBuffer(device, commandPool);
-	// Copy operation.
-	VkBufferCopy copyRegion = {};
-	copyRegion.srcOffset = 0;
-	copyRegion.dstOffset = 0;
-	copyRegion.size = size;
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-	endOneShotCommandBuffer(commandBuffer, device, commandPool, queue);
-}
-
-int VulkanUtilities::createImage(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const uint32_t & width, const uint32_t & height, const uint32_t & mipCount, const VkFormat & format, const VkImageTiling & tiling, const VkImageUsageFlags & usage, const VkMemoryPropertyFlags & properties, const bool cube, VkImage & image, VkDeviceMemory & imageMemory){
+int VulkanUtilities::createImage(const VkDevice & device, const uint32_t & width, const uint32_t & height, const uint32_t & mipCount, const VkFormat & format, const VkImageTiling & tiling, const VkImageUsageFlags & usage, const VkMemoryPropertyFlags & properties, const bool cube, VkImage & image, MemoryAllocator::Allocation & imageMemory, const VkImageLayout initialLayout){
 	// Create image.
 	VkImageCreateInfo imageInfo = {};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -507,7 +510,7 @@ int VulkanUtilities::createImage(const VkPhysicalDevice & physicalDevice, const
 	imageInfo.arrayLayers = cube ? 6 : 1;
 	imageInfo.format = format;
 	imageInfo.tiling = tiling;
-	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.initialLayout = initialLayout;
 	imageInfo.usage = usage;
 	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
@@ -516,41 +519,25 @@ int VulkanUtilities::createImage(const VkPhysicalDevice & physicalDevice, const
 		std::cerr << "Unable to create texture image." << std::endl;
 		return 3;
 	}
-	// Allocate memory for image.
+	// Allocate memory for image, in a shared block.
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device, image, &memRequirements);
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties, physicalDevice);
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
+	imageMemory = MemoryAllocator::allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_OPTIMAL);
+	if (imageMemory.memory == VK_NULL_HANDLE) {
 		std::cerr << "Unable to allocate texture memory." << std::endl;
 		return 3;
 	}
-	vkBindImageMemory(device, image, imageMemory, 0);
+	vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
 	return 0;
 }
 
-void VulkanUtilities::copyBufferToImage(const VkBuffer & srcBuffer, const VkImage & dstImage, const uint32_t & width, const uint32_t & height, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & queue, const bool cube){
+void VulkanUtilities::transitionImageLayout(const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & queue, VkImage & image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, const bool cube, const uint32_t & mipCount) {
 	VkCommandBuffer commandBuffer = beginOneShotCommandBuffer(device, commandPool);
-	// Copy operation.
-	VkBufferImageCopy region = {};
-	region.bufferOffset = 0;
-	region.bufferRowLength = 0; // Tightly packed.
-	region.bufferImageHeight = 0; // Tightly packed.
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = cube ? 6 : 1;
-	region.imageOffset = {0, 0, 0};
-	region.imageExtent = { width, height, 1};
-	vkCmdCopyBufferToImage(commandBuffer, srcBuffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	transitionImageLayout(commandBuffer, image, format, oldLayout, newLayout, cube, mipCount);
 	endOneShotCommandBuffer(commandBuffer, device, commandPool, queue);
 }
 
-void VulkanUtilities::transitionImageLayout(const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & queue, VkImage & image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, const bool cube, const uint32_t & mipCount) {
-	VkCommandBuffer commandBuffer = beginOneShotCommandBuffer(device, commandPool);
-	
+void VulkanUtilities::transitionImageLayout(VkCommandBuffer & commandBuffer, const VkImage & image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, const bool cube, const uint32_t & mipCount) {
 	VkPipelineStageFlags sourceStage;
 	VkPipelineStageFlags destinationStage;
 	
@@ -596,8 +583,6 @@ void VulkanUtilities::transitionImageLayout(const VkDevice & device, const VkCom
 	}
 
 	vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr,  0, nullptr,  1, &barrier );
-	
-	endOneShotCommandBuffer(commandBuffer, device, commandPool, queue);
 }
 
 VkImageView VulkanUtilities::createImageView(const VkDevice & device, const VkImage & image, const VkFormat format, const VkImageAspectFlags aspectFlags, const bool cube, const uint32_t & mipCount) {
@@ -619,6 +604,15 @@ VkImageView VulkanUtilities::createImageView(const VkDevice & device, const VkIm
 	return imageView;
 }
 
+bool VulkanUtilities::linearTilingSupported(const VkPhysicalDevice & physicalDevice, const VkFormat format, const VkImageUsageFlags usage, const uint32_t mipCount){
+	VkImageFormatProperties properties;
+	if(vkGetPhysicalDeviceImageFormatProperties(physicalDevice, format, VK_IMAGE_TYPE_2D, VK_IMAGE_TILING_LINEAR, usage, 0, &properties) != VK_SUCCESS){
+		return false;
+	}
+	// Linear images are often restricted to a single level.
+	return properties.maxMipLevels >= mipCount;
+}
+
 VkFormat VulkanUtilities::findSupportedFormat(const VkPhysicalDevice & physicalDevice, const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features){
 	for (VkFormat format : candidates) {
 		VkFormatProperties props;
@@ -641,7 +635,7 @@ bool VulkanUtilities::hasStencilComponent(VkFormat format) {
 	return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
 }
 
-VkSampler VulkanUtilities::createSampler(const VkDevice & device, const VkFilter filter, const VkSamplerAddressMode mode, const uint32_t mipCount){
+VkSampler VulkanUtilities::createSampler(const VkDevice & device, const VkFilter filter, const VkSamplerAddressMode mode, const float maxLod){
 	VkSampler sampler;
 	VkSamplerCreateInfo samplerInfo = {};
 	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -659,14 +653,14 @@ VkSampler VulkanUtilities::createSampler(const VkDevice & device, const VkFilter
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	samplerInfo.mipLodBias = 0.0f;
 	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = static_cast<float>(mipCount);
+	samplerInfo.maxLod = maxLod;
 	if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS) {
 		std::cerr << "Unable to create a sampler." << std::endl;
 	}
 	return sampler;
 }
 
-void VulkanUtilities::generateMipmaps(VkImage & image, const int32_t width, const int32_t height, const bool cube, const uint32_t mipCount, const VkFormat format, const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue){
+void VulkanUtilities::generateMipmaps(VkCommandBuffer & commandBuff, const VkImage & image, const int32_t width, const int32_t height, const bool cube, const uint32_t mipCount, const VkFormat format, const VkPhysicalDevice & physicalDevice){
 	// Do we support blitting?
 	VkFormatProperties formatProperties;
 	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
@@ -685,7 +679,6 @@ void VulkanUtilities::generateMipmaps(VkImage & image, const int32_t width, cons
 	barrier.subresourceRange.layerCount = cube ? 6 : 1;
 	barrier.subresourceRange.levelCount = 1;
 	// Blit the texture to each mip level.
-	VkCommandBuffer commandBuff = VulkanUtilities::beginOneShotCommandBuffer(device, commandPool);
 	uint32_t currentWidth = width;
 	uint32_t currentHeight = height;
 	for (uint32_t i = 1; i < mipCount; i++) {
@@ -728,70 +721,155 @@ void VulkanUtilities::generateMipmaps(VkImage & image, const int32_t width, cons
 	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 	vkCmdPipelineBarrier(commandBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-	// Submit the commands.
-	VulkanUtilities::endOneShotCommandBuffer(commandBuff, device, commandPool, graphicsQueue);
 }
 
-void VulkanUtilities::createTexture(const void * image, const uint32_t width, const uint32_t height, const bool cube, const uint32_t mipCount, const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue, VkImage & textureImage, VkDeviceMemory & textureMemory, VkImageView & textureView){
-	VkDeviceSize imageSize = width * height * 4 * (cube ? 6 : 1);
-	
-	VkBuffer stagingBufferImg;
-	VkDeviceMemory stagingBufferMemoryImg;
-	createBuffer(physicalDevice, device, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBufferImg, stagingBufferMemoryImg);
-	void* dataImg;
-	vkMapMemory(device, stagingBufferMemoryImg, 0, imageSize, 0, &dataImg);
-	memcpy(dataImg, image, static_cast<size_t>(imageSize));
-	vkUnmapMemory(device, stagingBufferMemoryImg);
-	// Create texture image.
-	createImage(physicalDevice, device, width, height, mipCount, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cube, textureImage, textureMemory);
+void VulkanUtilities::createTexture(const void * image, const uint32_t width, const uint32_t height, const bool cube, const uint32_t mipCount, const VkDevice & device, UploadContext & upload, MipmapGenerator & mipmaps, VkImage & textureImage, MemoryAllocator::Allocation & textureMemory, VkImageView & textureView){
+	const VkDeviceSize imageSize = VkDeviceSize(width) * height * 4 * (cube ? 6 : 1);
+	const UploadContext::Allocation staging = upload.stage(image, imageSize);
+	createTextureFromBuffer(staging.buffer, staging.offset, width, height, cube, mipCount, device, upload, mipmaps, textureImage, textureMemory, textureView);
+}
+
+void VulkanUtilities::createTextureFromBuffer(const VkBuffer & stagingBuffer, const VkDeviceSize stagingOffset, const uint32_t width, const uint32_t height, const bool cube, const uint32_t mipCount, const VkDevice & device, UploadContext & upload, MipmapGenerator & mipmaps, VkImage & textureImage, MemoryAllocator::Allocation & textureMemory, VkImageView & textureView){
+	// Create texture image, the levels are written by the compute shader (or by blits as a fallback).
+	createImage(device, width, height, mipCount, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cube, textureImage, textureMemory);
+	VkCommandBuffer & commandBuffer = upload.transferCommandBuffer();
 	// Prepare the image layout for the transfer (we don't care about what's in it before the copy).
-	transitionImageLayout(device, commandPool, graphicsQueue, textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, cube, mipCount);
-	// Copy from the buffer to the image.
-	copyBufferToImage(stagingBufferImg, textureImage, width, height, device, commandPool, graphicsQueue, cube);
-	// Generate the mipmaplevels, and optimize the layout of the image for sampling.
-	VulkanUtilities::generateMipmaps(textureImage, width, height, cube, mipCount, VK_FORMAT_R8G8B8A8_UNORM, physicalDevice, device, commandPool, graphicsQueue);
-	// Clean staging buffer.
-	vkDestroyBuffer(device, stagingBufferImg, nullptr);
-	vkFreeMemory(device, stagingBufferMemoryImg, nullptr);
+	transitionImageLayout(commandBuffer, textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, cube, mipCount);
+	// Copy from the buffer to the first level of the image.
+	VkBufferImageCopy region = {};
+	region.bufferOffset = stagingOffset;
+	region.bufferRowLength = 0; // Tightly packed.
+	region.bufferImageHeight = 0; // Tightly packed.
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = cube ? 6 : 1;
+	region.imageOffset = {0, 0, 0};
+	region.imageExtent = { width, height, 1};
+	vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+	// Hand the image to the graphics queue, where the levels are generated.
+	upload.releaseImage(textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipCount, cube ? 6 : 1, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+	// The mipmap levels are generated with the other pending textures, also optimizing the layout of the image for sampling.
+	mipmaps.add(textureImage, VK_FORMAT_R8G8B8A8_UNORM, width, height, cube, mipCount, true, true);
 	// Create texture view.
 	textureView = createImageView(device, textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, cube, mipCount);
 }
 
+void VulkanUtilities::createTexture(const TextureCache & texture, const uint32_t firstLevel, const VkPhysicalDevice & physicalDevice, const VkDevice & device, UploadContext & upload, VkImage & textureImage, MemoryAllocator::Allocation & textureMemory, VkImageView & textureView){
+	if(!texture.valid() || firstLevel >= texture.levelsCount()){
+		std::cerr << "Unable to create a texture from an invalid cache." << std::endl;
+		return;
+	}
+	const uint32_t mipCount = texture.levelsCount() - firstLevel;
+	const uint32_t width = std::max(1u, texture.width() >> firstLevel);
+	const uint32_t height = std::max(1u, texture.height() >> firstLevel);
+	const VkImageUsageFlags linearUsage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	if(upload.direct() && linearTilingSupported(physicalDevice, texture.format(), linearUsage, mipCount)){
+		// Write the levels in a linear image, following the layout chosen by the driver. It can still be the source of a copy when streamed.
+		createImage(device, width, height, mipCount, texture.format(), VK_IMAGE_TILING_LINEAR, linearUsage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, false, textureImage, textureMemory, VK_IMAGE_LAYOUT_PREINITIALIZED);
+		const bool blocks = texture.format() >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && texture.format() <= VK_FORMAT_BC7_SRGB_BLOCK;
+		for(uint32_t lid = 0; lid < mipCount; ++lid){
+			const TextureCache::Level & level = texture.level(firstLevel + lid);
+			VkImageSubresource subresource = {};
+			subresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			subresource.mipLevel = lid;
+			subresource.arrayLayer = 0;
+			VkSubresourceLayout layout;
+			vkGetImageSubresourceLayout(device, textureImage, &subresource, &layout);
+			// Compressed levels are stored as rows of 4x4 blocks.
+			const uint32_t levelHeight = std::max(1u, height >> lid);
+			const uint32_t rows = blocks ? (levelHeight + 3) / 4 : levelHeight;
+			const size_t rowSize = size_t(level.size) / rows;
+			for(uint32_t rid = 0; rid < rows; ++rid){
+				memcpy(textureMemory.data + layout.offset + rid * layout.rowPitch, texture.data() + level.offset + rid * rowSize, rowSize);
+			}
+		}
+		// The host writes are made visible by the submission, only the layout changes.
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = textureImage;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_PREINITIALIZED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = mipCount;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(upload.graphicsCommandBuffer(), VK_PIPELINE_STAGE_HOST_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		textureView = createImageView(device, textureImage, texture.format(), VK_IMAGE_ASPECT_COLOR_BIT, false, mipCount);
+		return;
+	}
+	// Levels are contiguous in the file, copy them all at once.
+	VkDeviceSize begin = texture.level(firstLevel).offset;
+	VkDeviceSize end = 0;
+	for(uint32_t lid = firstLevel; lid < texture.levelsCount(); ++lid){
+		begin = std::min(begin, VkDeviceSize(texture.level(lid).offset));
+		end = std::max(end, VkDeviceSize(texture.level(lid).offset + texture.level(lid).size));
+	}
+	const UploadContext::Allocation staging = upload.stage(texture.data() + begin, end - begin);
+	// Create texture image, the mip levels are already there. It can be the source of a copy when streamed.
+	createImage(device, width, height, mipCount, texture.format(), VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, textureImage, textureMemory);
+	VkCommandBuffer & commandBuffer = upload.transferCommandBuffer();
+	transitionImageLayout(commandBuffer, textureImage, texture.format(), VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false, mipCount);
+	// One copy region per level.
+	std::vector<VkBufferImageCopy> regions(mipCount);
+	for(uint32_t lid = 0; lid < mipCount; ++lid){
+		VkBufferImageCopy & region = regions[lid];
+		region = {};
+		region.bufferOffset = staging.offset + texture.level(firstLevel + lid).offset - begin;
+		region.bufferRowLength = 0; // Tightly packed.
+		region.bufferImageHeight = 0; // Tightly packed.
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = lid;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = {0, 0, 0};
+		region.imageExtent = { std::max(1u, width >> lid), std::max(1u, height >> lid), 1};
+	}
+	vkCmdCopyBufferToImage(commandBuffer, staging.buffer, textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+	// Hand the image to the graphics queue, ready for sampling.
+	upload.releaseImage(textureImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipCount, 1, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	// Create texture view.
+	textureView = createImageView(device, textureImage, texture.format(), VK_IMAGE_ASPECT_COLOR_BIT, false, mipCount);
+}
+
 VkDeviceSize VulkanUtilities::nextOffset(size_t size){
 	return (size/VulkanUtilities::uniformOffset+1)*VulkanUtilities::uniformOffset;
 }
 
-void VulkanUtilities::setupBuffers(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue, const Mesh & mesh, VkBuffer & vertexBuffer, VkDeviceMemory & vertexBufferMemory, VkBuffer & indexBuffer, VkDeviceMemory & indexBufferMemory){
-	VkDeviceSize bufferSize = sizeof(mesh.vertices[0]) * mesh.vertices.size();
-	
-	// Use a staging buffer as an intermediate.
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	VulkanUtilities::createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-	// Fill it.
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, mesh.vertices.data(), (size_t) bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
-	// Create the destination buffer.
-	VulkanUtilities::createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
-	// Copy from the staging buffer to the final.
-	// TODO: use specific command pool.
-	VulkanUtilities::copyBuffer(stagingBuffer, vertexBuffer, bufferSize, device, commandPool, graphicsQueue);
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
-	
+void VulkanUtilities::setupBuffers(const VkDevice & device, UploadContext & upload, const Mesh & mesh, VkBuffer & vertexBuffer, MemoryAllocator::Allocation & vertexBufferMemory, VkBuffer & indexBuffer, MemoryAllocator::Allocation & indexBufferMemory){
+	VulkanUtilities::setupBuffers(device, upload, mesh.vertices.data(), sizeof(Vertex) * mesh.vertices.size(), mesh.indices.data(), static_cast<uint32_t>(mesh.indices.size()), vertexBuffer, vertexBufferMemory, indexBuffer, indexBufferMemory);
+}
+
+void VulkanUtilities::setupBuffers(const VkDevice & device, UploadContext & upload, const void * vertices, const VkDeviceSize verticesSize, const uint32_t * indices, const uint32_t indicesCount, VkBuffer & vertexBuffer, MemoryAllocator::Allocation & vertexBufferMemory, VkBuffer & indexBuffer, MemoryAllocator::Allocation & indexBufferMemory){
+	/// Vertex buffer.
+	VulkanUtilities::setupBuffer(device, upload, vertices, verticesSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
 	/// Index buffer.
-	bufferSize = sizeof(mesh.indices[0]) * mesh.indices.size();
-	// Create and fill the staging buffer.
-	VulkanUtilities::createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, mesh.indices.data(), (size_t) bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
-	// Create and copy final buffer.
-	VulkanUtilities::createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
-	VulkanUtilities::copyBuffer(stagingBuffer, indexBuffer, bufferSize, device, commandPool, graphicsQueue);
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	VulkanUtilities::setupBuffer(device, upload, indices, sizeof(uint32_t) * indicesCount, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
 }
 
+void VulkanUtilities::setupBuffer(const VkDevice & device, UploadContext & upload, const void * content, const VkDeviceSize size, const VkBufferUsageFlags usage, VkBuffer & buffer, MemoryAllocator::Allocation & bufferMemory){
+	if(upload.direct()){
+		// Write in host visible device memory, visible to the device at the next submission. It can be copied elsewhere by the defragmenter.
+		VulkanUtilities::createBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
+		memcpy(bufferMemory.data, content, size_t(size));
+		return;
+	}
+	// Use the staging ring as an intermediate.
+	const UploadContext::Allocation staging = upload.stage(content, size);
+	// Create the destination buffer, it can be copied elsewhere by the defragmenter.
+	VulkanUtilities::createBuffer(device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+	// Copy from the staging buffer to the final one, with the other pending uploads.
+	VkBufferCopy copyRegion = {};
+	copyRegion.srcOffset = staging.offset;
+	copyRegion.dstOffset = 0;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(upload.transferCommandBuffer(), staging.buffer, buffer, 1, &copyRegion);
+	// Hand the buffer to the graphics queue.
+	const VkAccessFlags access = ((usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT) ? VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT : 0) | ((usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT) ? VK_ACCESS_INDEX_READ_BIT : 0);
+	upload.releaseBuffer(buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, access);
+}
@@ -2,21 +2,32 @@
 
 #include "common.hpp"
 #include "resources/MeshUtilities.hpp"
+#include "MemoryAllocator.hpp"
 #include <set>
 
+class TextureCache;
+class MipmapGenerator;
+class UploadContext;
+
 class VulkanUtilities {
 public:
 
 	struct ActiveQueues{
 		int graphicsQueue = -1;
 		int presentQueue = -1;
+		// Transfer only family, optional: uploads use the graphics queue without it.
+		int transferQueue = -1;
 
 		const bool isComplete() const {
 			return graphicsQueue >= 0 && presentQueue >= 0;
 		}
 
 		const std::set<int> getIndices() const {
-			return { graphicsQueue, presentQueue };
+			std::set<int> indices = { graphicsQueue, presentQueue };
+			if(transferQueue >= 0){
+				indices.insert(transferQueue);
+			}
+			return indices;
 		}
 	};
 	struct SwapchainSupportDetails {
@@ -69,32 +80,45 @@ private:
 	static VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR> availablePresentModes);
 	
 	/// Commands
-private:
+public:
 	static VkCommandBuffer beginOneShotCommandBuffer( const VkDevice & device,  const VkCommandPool & commandPool);
 	static void endOneShotCommandBuffer(VkCommandBuffer & commandBuffer,  const VkDevice & device,  const VkCommandPool & commandPool,  const VkQueue & queue);
 	
 	/// Memory
 public:
-	static int createBuffer(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkDeviceSize & size, const VkBufferUsageFlags & usage, const VkMemoryPropertyFlags & properties, VkBuffer & buffer, VkDeviceMemory & bufferMemory);
-private:
-	static void copyBuffer(const VkBuffer & srcBuffer, const VkBuffer & dstBuffer, const VkDeviceSize & size, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & queue);
-	static void copyBufferToImage(const VkBuffer & srcBuffer, const VkImage & dstImage, const uint32_t & width, const uint32_t & height, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & queue, const bool cube);
+	static int createBuffer(const VkDevice & device, const VkDeviceSize & size, const VkBufferUsageFlags & usage, const VkMemoryPropertyFlags & properties, VkBuffer & buffer, MemoryAllocator::Allocation & bufferMemory);
 	static uint32_t findMemoryType(const uint32_t typeFilter, const VkMemoryPropertyFlags & properties, const VkPhysicalDevice & physicalDevice);
 	
 	/// Geometry
 public:
-	static void setupBuffers(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue, const Mesh & mesh, VkBuffer & vertexBuffer, VkDeviceMemory & vertexBufferMemory, VkBuffer & indexBuffer, VkDeviceMemory & indexBufferMemory);
+	/// Buffers are filled by copies recorded in the upload context.
+	static void setupBuffers(const VkDevice & device, UploadContext & upload, const Mesh & mesh, VkBuffer & vertexBuffer, MemoryAllocator::Allocation & vertexBufferMemory, VkBuffer & indexBuffer, MemoryAllocator::Allocation & indexBufferMemory);
+	static void setupBuffer(const VkDevice & device, UploadContext & upload, const void * content, const VkDeviceSize size, const VkBufferUsageFlags usage, VkBuffer & buffer, MemoryAllocator::Allocation & bufferMemory);
+	static void setupBuffers(const VkDevice & device, UploadContext & upload, const void * vertices, const VkDeviceSize verticesSize, const uint32_t * indices, const uint32_t indicesCount, VkBuffer & vertexBuffer, MemoryAllocator::Allocation & vertexBufferMemory, VkBuffer & indexBuffer, MemoryAllocator::Allocation & indexBufferMemory);
 	
 	/// Textures
 public:
-	static int createImage(const VkPhysicalDevice & physicalDevice, const VkDevice & device, const uint32_t & width, const uint32_t & height, const uint32_t & mipCount, const VkFormat & format, const VkImageTiling & tiling, const VkImageUsageFlags & usage, const VkMemoryPropertyFlags & properties, const bool cube, VkImage & image, VkDeviceMemory & imageMemory);
+	static int createImage(const VkDevice & device, const uint32_t & width, const uint32_t & height, const uint32_t & mipCount, const VkFormat & format, const VkImageTiling & tiling, const VkImageUsageFlags & usage, const VkMemoryPropertyFlags & properties, const bool cube, VkImage & image, MemoryAllocator::Allocation & imageMemory, const VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED);
 	static void transitionImageLayout(const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & queue, VkImage & image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, const bool cube, const uint32_t & mipCount);
+	/// Record a layout transition in a command buffer.
+	static void transitionImageLayout(VkCommandBuffer & commandBuffer, const VkImage & image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, const bool cube, const uint32_t & mipCount);
 	static VkImageView createImageView(const VkDevice & device, const VkImage & image, const VkFormat format, const VkImageAspectFlags aspectFlags, const bool cube, const uint32_t & mipCount);
-	static VkSampler createSampler(const VkDevice & device, const VkFilter filter, const VkSamplerAddressMode mode, const uint32_t mipCount);
-	static void generateMipmaps(VkImage & image, const int32_t width, const int32_t height, const bool cube, const uint32_t mipCount, const VkFormat format, const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue);
-	static void createTexture(const void * image, const uint32_t width, const uint32_t height, const bool cube, const uint32_t mipCount,  const VkPhysicalDevice & physicalDevice, const VkDevice & device, const VkCommandPool & commandPool, const VkQueue & graphicsQueue, VkImage & textureImage, VkDeviceMemory & textureMemory, VkImageView & textureView);
+	/// Sampler reading mip levels up to maxLod, pass VK_LOD_CLAMP_NONE to use all levels of the textures.
+	static VkSampler createSampler(const VkDevice & device, const VkFilter filter, const VkSamplerAddressMode mode, const float maxLod);
+	/// Record the generation of the mip levels with a chain of blits, used when the compute path is unavailable.
+	static void generateMipmaps(VkCommandBuffer & commandBuffer, const VkImage & image, const int32_t width, const int32_t height, const bool cube, const uint32_t mipCount, const VkFormat format, const VkPhysicalDevice & physicalDevice);
+	/// Create a texture from RGBA8 pixels, its mip levels are generated at the next flush of the generator.
+	static void createTexture(const void * image, const uint32_t width, const uint32_t height, const bool cube, const uint32_t mipCount, const VkDevice & device, UploadContext & upload, MipmapGenerator & mipmaps, VkImage & textureImage, MemoryAllocator::Allocation & textureMemory, VkImageView & textureView);
+	/// Create a texture from RGBA8 pixels already in a staging buffer (the six faces one after the other for a cubemap).
+	/// The buffer has to be kept until the upload context is done with the copy.
+	static void createTextureFromBuffer(const VkBuffer & stagingBuffer, const VkDeviceSize stagingOffset, const uint32_t width, const uint32_t height, const bool cube, const uint32_t mipCount,  const VkDevice & device, UploadContext & upload, MipmapGenerator & mipmaps, VkImage & textureImage, MemoryAllocator::Allocation & textureMemory, VkImageView & textureView);
+	/// Create a texture from the cooked mip chain of a texture cache, starting at the given level, all levels copied in a single transfer.
+	/// When the upload context allows direct writes and the format supports it, the levels are written in a linear image instead.
+	static void createTexture(const TextureCache & texture, const uint32_t firstLevel, const VkPhysicalDevice & physicalDevice, const VkDevice & device, UploadContext & upload, VkImage & textureImage, MemoryAllocator::Allocation & textureMemory, VkImageView & textureView);
 private:
 	static VkFormat findSupportedFormat(const VkPhysicalDevice & physicalDevice, const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
+	/// Can images of the given format, usage and mip count be created with linear tiling.
+	static bool linearTilingSupported(const VkPhysicalDevice & physicalDevice, const VkFormat format, const VkImageUsageFlags usage, const uint32_t mipCount);
 	
 	
 private:
@@ -25,6 +25,12 @@
 #define M_PI	3.14159265358979323846
 #endif
 
+// SSE intrinsics are available on all x86 targets.
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define DRAGON_SSE
+#include <xmmintrin.h>
+#endif
+
 #include <iostream>
 #include <vector>
 #include <string>
@@ -45,6 +51,4 @@ struct ObjectInfos {
 	float shininess;
 };
 
-#define MAX_MIPMAP_LEVELS 8
-
 #endif /* common_h */
@@ -3,8 +3,13 @@
 #include <set>
 #include <algorithm>
 #include <fstream>
+#include <memory>
+#include <thread>
+#include <cerrno>
+#include <cstdlib>
 
 #include "Renderer.hpp"
+#include "ThreadUtilities.hpp"
 #include "input/Input.hpp"
 
 const int WIDTH = 1280;
@@ -42,9 +47,78 @@ void window_iconify_callback(GLFWwindow* window, int iconified){
 	Input::manager().pauseEvent(iconified);
 }
 
+/// Parse an integer option, false if the string is not a number.
+static bool parseInteger(const std::string & str, long & value){
+	char * end = nullptr;
+	errno = 0;
+	value = std::strtol(str.c_str(), &end, 10);
+	return !str.empty() && *end == '\0' && errno == 0;
+}
+
+/// Parse a decimal option, false if the string is not a number.
+static bool parseFloat(const std::string & str, float & value){
+	char * end = nullptr;
+	errno = 0;
+	value = std::strtof(str.c_str(), &end);
+	return !str.empty() && *end == '\0' && errno == 0;
+}
+
 /// Entry point.
 
-int main() {
+int main(int argc, char** argv) {
+
+	// Options.
+	MeshUtilities::VertexFormat vertexFormat = MeshUtilities::Standard;
+	float lodThreshold = 1.0f;
+	size_t textureBudget = 256;
+	size_t uploadBudget = 4096;
+	size_t defragmentationBudget = 1024;
+	for(int i = 1; i < argc; ++i){
+		if(std::string(argv[i]) == "--compact-vertices"){
+			vertexFormat = MeshUtilities::Compact;
+		} else if(std::string(argv[i]) == "--lod-threshold" && i + 1 < argc){
+			// Maximum error in pixels of the levels of detail.
+			float threshold = 0.0f;
+			if(!parseFloat(argv[++i], threshold) || !(threshold >= 0.0f)){
+				std::cerr << "Invalid level of detail threshold \"" << argv[i] << "\", using " << lodThreshold << "." << std::endl;
+			} else {
+				lodThreshold = threshold;
+			}
+		} else if(std::string(argv[i]) == "--threads" && i + 1 < argc){
+			// Number of threads used for loading and processing assets, at most the number of cores.
+			long threads = 0;
+			if(!parseInteger(argv[++i], threads) || threads < 1){
+				std::cerr << "Invalid thread count \"" << argv[i] << "\", using all cores." << std::endl;
+			} else {
+				const long cores = long(std::thread::hardware_concurrency());
+				ThreadUtilities::setThreadCount(unsigned(cores > 0 ? std::min(threads, cores) : threads));
+			}
+		} else if(std::string(argv[i]) == "--texture-budget" && i + 1 < argc){
+			// Device memory for textures in MB, top levels of the least visible ones are dropped above it.
+			long budget = 0;
+			if(!parseInteger(argv[++i], budget) || budget < 0){
+				std::cerr << "Invalid texture budget \"" << argv[i] << "\", using " << textureBudget << "MB." << std::endl;
+			} else {
+				textureBudget = size_t(budget);
+			}
+		} else if(std::string(argv[i]) == "--upload-budget" && i + 1 < argc){
+			// Texture levels streamed each frame in KB.
+			long budget = 0;
+			if(!parseInteger(argv[++i], budget) || budget < 0){
+				std::cerr << "Invalid upload budget \"" << argv[i] << "\", using " << uploadBudget << "KB." << std::endl;
+			} else {
+				uploadBudget = size_t(budget);
+			}
+		} else if(std::string(argv[i]) == "--defrag-budget" && i + 1 < argc){
+			// Resources moved each frame to compact device memory in KB, 0 to disable.
+			long budget = 0;
+			if(!parseInteger(argv[++i], budget) || budget < 0){
+				std::cerr << "Invalid defragmentation budget \"" << argv[i] << "\", using " << defragmentationBudget << "KB." << std::endl;
+			} else {
+				defragmentationBudget = size_t(budget);
+			}
+		}
+	}
 
 	/// Init GLFW3.
 	if(!glfwInit()){
@@ -87,8 +161,20 @@ int main() {
 	Swapchain swapchain(instance, surface, width, height);
 	VkRenderPassBeginInfo finalPassInfos;
 	
-	/// Create the renderer.	
-	Renderer renderer(swapchain, width, height);
+	/// Create the renderer, this fails if an asset can't be loaded.
+	std::unique_ptr<Renderer> rendererPtr;
+	try {
+		rendererPtr.reset(new Renderer(swapchain, width, height, vertexFormat));
+	} catch(const std::exception & e){
+		std::cerr << "Unable to load the assets: " << e.what() << std::endl;
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return 3;
+	}
+	Renderer & renderer = *rendererPtr;
+	renderer.lodThreshold(lodThreshold);
+	renderer.textureBudgets(textureBudget << 20, uploadBudget << 10);
+	renderer.defragmentationBudget(defragmentationBudget << 10);
 	Input::manager().resizeEvent(width, height);
 	
 	/// Register callbacks.
@@ -101,6 +187,7 @@ int main() {
 	glfwSetWindowIconifyCallback(window, window_iconify_callback);
 	
 	double timer = glfwGetTime();
+	double statisticsTimer = timer;
 	
 	/// Main loop.
 	while(!glfwWindowShouldClose(window)){
@@ -137,6 +224,16 @@ int main() {
 		}
 		swapchain.step();
 		
+		// Display the culling results every second.
+		if(currentTime - statisticsTimer > 1.0){
+			statisticsTimer = currentTime;
+			const Renderer::CullingStatistics & statistics = renderer.cullingStatistics();
+			std::string title = "Dragon Vulkan - " + std::to_string(statistics.visible) + " visible, " + std::to_string(statistics.culled) + " culled, " + std::to_string(statistics.casters) + " casters, " + std::to_string(statistics.culledCasters) + " culled casters, " + std::to_string(renderer.textureSize() >> 20) + "MB of textures";
+			// Fragmentation of the device memory blocks.
+			const MemoryAllocator::Statistics memory = MemoryAllocator::statistics();
+			title += ", " + std::to_string(memory.blocks) + " memory blocks, " + std::to_string(memory.freeSize >> 20) + "MB free, largest range " + std::to_string(memory.largestFree >> 20) + "MB";
+			glfwSetWindowTitle(window, title.c_str());
+		}
 	}
 
 	/// Cleanup.
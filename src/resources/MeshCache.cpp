@@ -0,0 +1,183 @@
+#include "MeshCache.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+
+static const char cacheMagic[4] = { 'D', 'V', 'M', 'H' };
+// Post-transform cache size targeted when reordering triangles.
+static const unsigned int vertexCacheSize = 16;
+// Allowed ACMR degradation when clustering triangles to reduce overdraw.
+static const float overdrawThreshold = 1.05f;
+// Maximum simplification error for levels of detail, the mesh being in [-1,1].
+static const float maxLodError = 0.1f;
+// Meshlets size limits.
+static const size_t meshletMaxVertices = 64;
+static const size_t meshletMaxTriangles = 124;
+// Preference given to normal alignment over vertex reuse when growing meshlets.
+static const float meshletConeWeight = 1.0f;
+
+uint64_t MeshCache::layoutHash(){
+	const auto binding = Vertex::getBindingDescription();
+	const auto attributes = Vertex::getAttributeDescriptions();
+	uint64_t hash = Resources::hashBytes(&binding.stride, sizeof(binding.stride));
+	for(const auto & attribute : attributes){
+		hash = Resources::hashBytes(&attribute.location, sizeof(attribute.location), hash);
+		hash = Resources::hashBytes(&attribute.format, sizeof(attribute.format), hash);
+		hash = Resources::hashBytes(&attribute.offset, sizeof(attribute.offset), hash);
+	}
+	return hash;
+}
+
+MeshCache::MeshCache(const std::string & objPath){
+	const std::string cachePath = objPath.substr(0, objPath.find_last_of('.')) + ".dvmesh";
+	if(!map(cachePath, objPath)){
+		build(cachePath, objPath);
+	}
+}
+
+bool MeshCache::map(const std::string & cachePath, const std::string & objPath){
+	uint64_t sourceSize = 0;
+	uint64_t sourceTime = 0;
+	uint64_t cacheSize = 0;
+	uint64_t cacheTime = 0;
+	if(!Resources::fileInfos(objPath, sourceSize, sourceTime) || !Resources::fileInfos(cachePath, cacheSize, cacheTime)){
+		return false;
+	}
+	std::unique_ptr<MappedFile> file(new MappedFile(cachePath));
+	if(!file->valid() || file->size() < sizeof(Header)){
+		return false;
+	}
+	Header header;
+	memcpy(&header, file->data(), sizeof(Header));
+	if(memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != version || header.layoutHash != layoutHash() || header.lodsCount == 0 || header.lodsCount > maxLodsCount){
+		return false;
+	}
+	const size_t expectedSize = sizeof(Header) + sizeof(Vertex) * size_t(header.verticesCount) + sizeof(uint32_t) * size_t(header.indicesCount) + sizeof(Meshlet) * size_t(header.meshletsCount);
+	if(file->size() != expectedSize || header.sourceSize != sourceSize){
+		return false;
+	}
+	// A different modification time doesn't always mean different content (checkout, copy), compare hashes.
+	if(header.sourceTime != sourceTime){
+		if(header.sourceHash != Resources::hashFile(objPath)){
+			return false;
+		}
+		// Store the new time, so that the source isn't hashed again at the next launch.
+		header.sourceTime = sourceTime;
+		file.reset();
+		std::fstream out(cachePath, std::ios::binary | std::ios::in | std::ios::out);
+		out.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+		out.close();
+		if(!out){
+			std::cerr << "Unable to update mesh cache at path \"" << cachePath << "\"." << std::endl;
+		}
+		file.reset(new MappedFile(cachePath));
+		if(!file->valid() || file->size() != expectedSize){
+			return false;
+		}
+	}
+	
+	const Vertex * vertices = reinterpret_cast<const Vertex *>(file->data() + sizeof(Header));
+	const uint32_t * indices = reinterpret_cast<const uint32_t *>(file->data() + sizeof(Header) + sizeof(Vertex) * size_t(header.verticesCount));
+	const Meshlet * meshlets = reinterpret_cast<const Meshlet *>(file->data() + sizeof(Header) + sizeof(Vertex) * size_t(header.verticesCount) + sizeof(uint32_t) * size_t(header.indicesCount));
+	// Ranges and indices are used for draws and culling without further checks, a corrupted cache is rebuilt.
+	for(uint32_t lid = 0; lid < header.lodsCount; ++lid){
+		if(uint64_t(header.lods[lid].firstIndex) + header.lods[lid].indicesCount > header.indicesCount){
+			return false;
+		}
+	}
+	for(uint32_t mid = 0; mid < header.meshletsCount; ++mid){
+		if(uint64_t(meshlets[mid].firstIndex) + meshlets[mid].indicesCount > header.indicesCount){
+			return false;
+		}
+	}
+	for(uint32_t iid = 0; iid < header.indicesCount; ++iid){
+		if(indices[iid] >= header.verticesCount){
+			return false;
+		}
+	}
+	
+	_header = header;
+	_vertices = vertices;
+	_indices = indices;
+	_meshlets = meshlets;
+	_file = std::move(file);
+	std::cout << "Mesh loaded from cache with " << _header.lods[0].indicesCount/3 << " faces, " << _header.verticesCount << " vertices, " << _header.lodsCount << " levels of detail, " << _header.meshletsCount << " meshlets." << std::endl;
+	return true;
+}
+
+void MeshCache::build(const std::string & cachePath, const std::string & objPath){
+	// An empty header if the OBJ can't be loaded.
+	memset(&_header, 0, sizeof(Header));
+	MeshUtilities::loadObj(objPath, _mesh, MeshUtilities::Indexed);
+	if(_mesh.vertices.empty()){
+		std::cerr << "Unable to build mesh cache from \"" << objPath << "\"." << std::endl;
+		return;
+	}
+	MeshUtilities::centerAndUnitMesh(_mesh);
+	MeshUtilities::computeTangentsAndBinormals(_mesh);
+	MeshOptimizer::optimizeVertexCache(_mesh, vertexCacheSize, overdrawThreshold);
+	// Meshlets are contiguous in the index buffer, and vertices are numbered in their order.
+	MeshOptimizer::buildMeshlets(_mesh, meshletMaxVertices, meshletMaxTriangles, meshletConeWeight, _meshletsData);
+	MeshOptimizer::optimizeVertexFetch(_mesh, vertexCacheSize);
+	
+	// Levels of detail share the vertices, their indices are appended after the full resolution ones.
+	_header.lodsCount = 1;
+	_header.lods[0] = { 0, uint32_t(_mesh.indices.size()), 0.0f };
+	std::vector<uint32_t> indices = _mesh.indices;
+	while(_header.lodsCount < maxLodsCount){
+		const Lod & previous = _header.lods[_header.lodsCount - 1];
+		std::vector<uint32_t> lodIndices;
+		const float error = MeshOptimizer::simplify(_mesh, previous.indicesCount / 2, maxLodError, lodIndices);
+		// Stop when borders, seams or the error limit prevent further simplification.
+		if(lodIndices.empty() || lodIndices.size() > size_t(previous.indicesCount) * 3 / 4){
+			break;
+		}
+		_mesh.indices.swap(lodIndices);
+		MeshOptimizer::optimizeVertexCache(_mesh, vertexCacheSize, overdrawThreshold);
+		_mesh.indices.swap(lodIndices);
+		_header.lods[_header.lodsCount] = { uint32_t(indices.size()), uint32_t(lodIndices.size()), error };
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.end());
+		std::cout << "Mesh: level of detail " << _header.lodsCount << " with " << lodIndices.size()/3 << " faces, error " << error << "." << std::endl;
+		++_header.lodsCount;
+	}
+	_mesh.indices.swap(indices);
+	
+	memcpy(_header.magic, cacheMagic, sizeof(cacheMagic));
+	_header.version = version;
+	_header.verticesCount = uint32_t(_mesh.vertices.size());
+	_header.indicesCount = uint32_t(_mesh.indices.size());
+	_header.meshletsCount = uint32_t(_meshletsData.size());
+	MeshUtilities::computeBoundingBox(_mesh, _header.bboxMin, _header.bboxMax);
+	_header.layoutHash = layoutHash();
+	Resources::fileInfos(objPath, _header.sourceSize, _header.sourceTime);
+	_header.sourceHash = Resources::hashFile(objPath);
+	_vertices = _mesh.vertices.data();
+	_indices = _mesh.indices.data();
+	_meshlets = _meshletsData.data();
+	
+	// Write to a temporary file first so that a concurrent reader never maps a partial cache.
+	const std::string tempPath = cachePath + ".tmp";
+	std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+	if(!out){
+		std::cerr << "Unable to write mesh cache at path \"" << cachePath << "\"." << std::endl;
+		return;
+	}
+	out.write(reinterpret_cast<const char *>(&_header), sizeof(Header));
+	out.write(reinterpret_cast<const char *>(_mesh.vertices.data()), sizeof(Vertex) * _mesh.vertices.size());
+	out.write(reinterpret_cast<const char *>(_mesh.indices.data()), sizeof(uint32_t) * _mesh.indices.size());
+	out.write(reinterpret_cast<const char *>(_meshletsData.data()), sizeof(Meshlet) * _meshletsData.size());
+	out.close();
+	if(!out){
+		std::cerr << "Unable to write mesh cache at path \"" << cachePath << "\"." << std::endl;
+		std::remove(tempPath.c_str());
+		return;
+	}
+	// Windows doesn't replace existing files when renaming.
+	std::remove(cachePath.c_str());
+	if(std::rename(tempPath.c_str(), cachePath.c_str()) != 0){
+		std::cerr << "Unable to write mesh cache at path \"" << cachePath << "\"." << std::endl;
+		std::remove(tempPath.c_str());
+	}
+}
@@ -0,0 +1,84 @@
+#ifndef MeshCache_h
+#define MeshCache_h
+
+#include "../common.hpp"
+#include "MeshUtilities.hpp"
+#include "Resources.hpp"
+#include <memory>
+
+/// Processed mesh data, read from a binary .dvmesh file stored next to the source OBJ.
+/// The cache is rebuilt when missing, or when the source or the vertex layout changed.
+class MeshCache {
+	
+public:
+	
+	/// Bump when the processing applied to the OBJ changes.
+	static const uint32_t version = 5;
+	
+	/// Maximum number of levels of detail, including the full resolution one.
+	static const uint32_t maxLodsCount = 5;
+	
+	/// Range of the index buffer for a level of detail, and its simplification error in mesh units.
+	struct Lod {
+		uint32_t firstIndex;
+		uint32_t indicesCount;
+		float error;
+	};
+	
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t verticesCount;
+		uint32_t indicesCount;
+		glm::vec3 bboxMin;
+		glm::vec3 bboxMax;
+		uint64_t layoutHash;
+		uint64_t sourceSize;
+		uint64_t sourceTime;
+		uint64_t sourceHash;
+		uint32_t lodsCount;
+		Lod lods[maxLodsCount];
+		uint32_t meshletsCount;
+	};
+	
+	/// Map the cache of an OBJ file, building it first if needed.
+	MeshCache(const std::string & objPath);
+	
+	MeshCache(const MeshCache &) = delete;
+	MeshCache & operator=(const MeshCache &) = delete;
+	
+	bool valid() const { return _vertices != nullptr; }
+	
+	const Vertex * vertices() const { return _vertices; }
+	const uint32_t * indices() const { return _indices; }
+	uint32_t verticesCount() const { return _header.verticesCount; }
+	uint32_t indicesCount() const { return _header.indicesCount; }
+	uint32_t lodsCount() const { return _header.lodsCount; }
+	const Lod & lod(uint32_t i) const { return _header.lods[i]; }
+	/// Meshlets of the full resolution level.
+	const Meshlet * meshlets() const { return _meshlets; }
+	uint32_t meshletsCount() const { return _header.meshletsCount; }
+	const glm::vec3 & bboxMin() const { return _header.bboxMin; }
+	const glm::vec3 & bboxMax() const { return _header.bboxMax; }
+	
+	/// Hash of the Vertex memory layout, as described to the pipeline.
+	static uint64_t layoutHash();
+	
+private:
+	
+	/// Map the cache file and check it against the source, return false if it is missing or outdated.
+	bool map(const std::string & cachePath, const std::string & objPath);
+	
+	/// Load and process the OBJ, then write the cache. The processed mesh is kept in memory.
+	void build(const std::string & cachePath, const std::string & objPath);
+	
+	Header _header;
+	const Vertex * _vertices = nullptr;
+	const uint32_t * _indices = nullptr;
+	const Meshlet * _meshlets = nullptr;
+	std::unique_ptr<MappedFile> _file;
+	Mesh _mesh;
+	std::vector<Meshlet> _meshletsData;
+};
+
+#endif
@@ -0,0 +1,738 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+using namespace std;
+
+// FIFO cache simulation: a vertex is cached if less than cacheSize misses happened since it was last transformed.
+struct FifoCache {
+	
+	FifoCache(size_t verticesCount, unsigned int cacheSize) : _stamps(verticesCount, 0), _cacheSize(cacheSize), _time(cacheSize + 1) {}
+	
+	// Returns true if the vertex had to be transformed.
+	bool access(uint32_t vertex){
+		if(_time - _stamps[vertex] <= _cacheSize){
+			return false;
+		}
+		_stamps[vertex] = _time++;
+		return true;
+	}
+	
+	void flush(){
+		_time += _cacheSize + 1;
+	}
+	
+private:
+	vector<unsigned int> _stamps;
+	unsigned int _cacheSize;
+	unsigned int _time;
+};
+
+// Weighted sum of squared distances to a set of planes, stored as the coefficients of a symmetric 4x4 matrix.
+struct Quadric {
+	
+	Quadric(){}
+	
+	// Squared distance to the plane dot(n,p)+d = 0, scaled by the weight.
+	Quadric(const glm::dvec3 & n, double d, double weight){
+		_a00 = weight * n.x * n.x; _a01 = weight * n.x * n.y; _a02 = weight * n.x * n.z;
+		_a11 = weight * n.y * n.y; _a12 = weight * n.y * n.z; _a22 = weight * n.z * n.z;
+		_b0 = weight * n.x * d; _b1 = weight * n.y * d; _b2 = weight * n.z * d;
+		_c = weight * d * d;
+		_weight = weight;
+	}
+	
+	void add(const Quadric & q){
+		_a00 += q._a00; _a01 += q._a01; _a02 += q._a02;
+		_a11 += q._a11; _a12 += q._a12; _a22 += q._a22;
+		_b0 += q._b0; _b1 += q._b1; _b2 += q._b2;
+		_c += q._c;
+		_weight += q._weight;
+	}
+	
+	// Weighted average of the squared distances.
+	double error(const glm::vec3 & p) const {
+		if(_weight == 0.0){
+			return 0.0;
+		}
+		const double x = p.x, y = p.y, z = p.z;
+		const double err = x * (_a00 * x + 2.0 * (_a01 * y + _a02 * z + _b0)) + y * (_a11 * y + 2.0 * (_a12 * z + _b1)) + z * (_a22 * z + 2.0 * _b2) + _c;
+		return std::max(err, 0.0) / _weight;
+	}
+	
+private:
+	double _a00 = 0.0, _a01 = 0.0, _a02 = 0.0, _a11 = 0.0, _a12 = 0.0, _a22 = 0.0;
+	double _b0 = 0.0, _b1 = 0.0, _b2 = 0.0;
+	double _c = 0.0;
+	double _weight = 0.0;
+};
+
+MeshOptimizer::VertexCacheStatistics MeshOptimizer::analyzeVertexCache(const std::vector<uint32_t> & indices, size_t verticesCount, unsigned int cacheSize){
+	VertexCacheStatistics stats;
+	if(indices.empty()){
+		return stats;
+	}
+	FifoCache cache(verticesCount, cacheSize);
+	vector<bool> referenced(verticesCount, false);
+	size_t misses = 0;
+	size_t referencedCount = 0;
+	for(const uint32_t vid : indices){
+		misses += cache.access(vid) ? 1 : 0;
+		if(!referenced[vid]){
+			referenced[vid] = true;
+			++referencedCount;
+		}
+	}
+	stats.acmr = float(misses) / float(indices.size() / 3);
+	stats.atvr = float(misses) / float(referencedCount);
+	return stats;
+}
+
+void MeshOptimizer::optimizeVertexCache(Mesh & mesh, unsigned int cacheSize, float overdrawThreshold){
+	if(mesh.indices.size() < 3 || mesh.vertices.empty()){
+		return;
+	}
+	const VertexCacheStatistics before = analyzeVertexCache(mesh.indices, mesh.vertices.size(), cacheSize);
+	
+	vector<uint32_t> reordered;
+	const vector<uint32_t> clusters = tipsify(mesh.indices, mesh.vertices.size(), cacheSize, reordered);
+	if(overdrawThreshold > 1.0f){
+		optimizeOverdraw(mesh, clusters, cacheSize, overdrawThreshold, reordered);
+	}
+	mesh.indices.swap(reordered);
+	
+	const VertexCacheStatistics after = analyzeVertexCache(mesh.indices, mesh.vertices.size(), cacheSize);
+	std::cout << "Mesh: vertex cache (" << cacheSize << " entries) ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << "." << std::endl;
+}
+
+MeshOptimizer::VertexFetchStatistics MeshOptimizer::analyzeVertexFetch(const std::vector<uint32_t> & indices, size_t verticesCount, size_t vertexSize, unsigned int cacheSize){
+	const size_t lineSize = 64;
+	const unsigned int cachedLines = 128;
+	
+	VertexFetchStatistics stats;
+	if(indices.empty()){
+		return stats;
+	}
+	FifoCache transformCache(verticesCount, cacheSize);
+	FifoCache lineCache((verticesCount * vertexSize + lineSize - 1) / lineSize, cachedLines);
+	vector<bool> referenced(verticesCount, false);
+	size_t referencedCount = 0;
+	for(const uint32_t vid : indices){
+		if(!referenced[vid]){
+			referenced[vid] = true;
+			++referencedCount;
+		}
+		if(!transformCache.access(vid)){
+			continue;
+		}
+		const size_t firstLine = (vid * vertexSize) / lineSize;
+		const size_t lastLine = ((vid + 1) * vertexSize - 1) / lineSize;
+		for(size_t line = firstLine; line <= lastLine; ++line){
+			stats.bytesFetched += lineCache.access(uint32_t(line)) ? lineSize : 0;
+		}
+	}
+	stats.bytesPerVertex = float(stats.bytesFetched) / float(referencedCount);
+	stats.overfetch = stats.bytesPerVertex / float(vertexSize);
+	return stats;
+}
+
+void MeshOptimizer::optimizeVertexFetch(Mesh & mesh, unsigned int cacheSize){
+	if(mesh.indices.empty() || mesh.vertices.empty()){
+		return;
+	}
+	const VertexFetchStatistics before = analyzeVertexFetch(mesh.indices, mesh.vertices.size(), sizeof(Vertex), cacheSize);
+	
+	const uint32_t unused = 0xFFFFFFFF;
+	vector<uint32_t> remap(mesh.vertices.size(), unused);
+	vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for(uint32_t & vid : mesh.indices){
+		if(remap[vid] == unused){
+			remap[vid] = uint32_t(vertices.size());
+			vertices.push_back(mesh.vertices[vid]);
+		}
+		vid = remap[vid];
+	}
+	const size_t dropped = mesh.vertices.size() - vertices.size();
+	mesh.vertices.swap(vertices);
+	
+	const VertexFetchStatistics after = analyzeVertexFetch(mesh.indices, mesh.vertices.size(), sizeof(Vertex), cacheSize);
+	std::cout << "Mesh: vertex fetch " << before.bytesPerVertex << " -> " << after.bytesPerVertex << " bytes per vertex (overfetch " << before.overfetch << " -> " << after.overfetch << "), " << dropped << " unreferenced vertices removed." << std::endl;
+}
+
+std::vector<uint32_t> MeshOptimizer::tipsify(const std::vector<uint32_t> & indices, size_t verticesCount, unsigned int cacheSize, std::vector<uint32_t> & reordered){
+	const size_t trianglesCount = indices.size() / 3;
+	
+	// Vertex-triangle adjacency, stored contiguously per vertex.
+	vector<uint32_t> offsets(verticesCount + 1, 0);
+	for(const uint32_t vid : indices){
+		++offsets[vid + 1];
+	}
+	partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	vector<uint32_t> adjacency(indices.size());
+	vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for(size_t tid = 0; tid < trianglesCount; ++tid){
+		for(size_t c = 0; c < 3; ++c){
+			adjacency[fill[indices[3*tid+c]]++] = uint32_t(tid);
+		}
+	}
+	// Number of non-emitted triangles using each vertex.
+	vector<int> liveTriangles(verticesCount);
+	for(size_t vid = 0; vid < verticesCount; ++vid){
+		liveTriangles[vid] = int(offsets[vid + 1] - offsets[vid]);
+	}
+	
+	vector<unsigned int> stamps(verticesCount, 0);
+	vector<bool> emitted(trianglesCount, false);
+	vector<uint32_t> deadEnds;
+	deadEnds.reserve(indices.size());
+	vector<uint32_t> candidates;
+	vector<uint32_t> clusters;
+	reordered.clear();
+	reordered.reserve(indices.size());
+	
+	unsigned int time = cacheSize + 1;
+	size_t cursor = 0;
+	long fanning = 0;
+	bool newCluster = true;
+	
+	while(fanning >= 0){
+		if(newCluster){
+			// Skip empty clusters (isolated vertices).
+			if(clusters.empty() || clusters.back() != reordered.size() / 3){
+				clusters.push_back(uint32_t(reordered.size() / 3));
+			}
+			newCluster = false;
+		}
+		// Emit all the remaining triangles around the fanning vertex.
+		candidates.clear();
+		for(uint32_t aid = offsets[fanning]; aid < offsets[fanning + 1]; ++aid){
+			const uint32_t tid = adjacency[aid];
+			if(emitted[tid]){
+				continue;
+			}
+			for(size_t c = 0; c < 3; ++c){
+				const uint32_t vid = indices[3*tid+c];
+				reordered.push_back(vid);
+				deadEnds.push_back(vid);
+				candidates.push_back(vid);
+				--liveTriangles[vid];
+				if(time - stamps[vid] > cacheSize){
+					stamps[vid] = time++;
+				}
+			}
+			emitted[tid] = true;
+		}
+		
+		// Pick the next fanning vertex among the candidates still in cache after its fan is emitted, the oldest first.
+		long next = -1;
+		int bestPriority = -1;
+		for(const uint32_t vid : candidates){
+			if(liveTriangles[vid] <= 0){
+				continue;
+			}
+			int priority = 0;
+			if(int(time - stamps[vid]) + 2 * liveTriangles[vid] <= int(cacheSize)){
+				priority = int(time - stamps[vid]);
+			}
+			if(priority > bestPriority){
+				bestPriority = priority;
+				next = long(vid);
+			}
+		}
+		if(next >= 0){
+			fanning = next;
+			continue;
+		}
+		// Dead end: go back to a recently used vertex, or to the next non-exhausted one in input order.
+		newCluster = true;
+		fanning = -1;
+		while(!deadEnds.empty()){
+			const uint32_t vid = deadEnds.back();
+			deadEnds.pop_back();
+			if(liveTriangles[vid] > 0){
+				fanning = long(vid);
+				break;
+			}
+		}
+		while(fanning < 0 && cursor < verticesCount){
+			if(liveTriangles[cursor] > 0){
+				fanning = long(cursor);
+			}
+			++cursor;
+		}
+	}
+	return clusters;
+}
+
+void MeshOptimizer::optimizeOverdraw(const Mesh & mesh, const std::vector<uint32_t> & clusters, unsigned int cacheSize, float threshold, std::vector<uint32_t> & indices){
+	const size_t trianglesCount = indices.size() / 3;
+	
+	// Split the clusters further wherever the ACMR reached since the cluster start is close enough to the whole cluster's one.
+	vector<uint32_t> boundaries;
+	FifoCache cache(mesh.vertices.size(), cacheSize);
+	for(size_t cid = 0; cid < clusters.size(); ++cid){
+		const size_t begin = clusters[cid];
+		const size_t end = (cid + 1 < clusters.size()) ? clusters[cid + 1] : trianglesCount;
+		
+		cache.flush();
+		size_t clusterMisses = 0;
+		for(size_t tid = begin; tid < end; ++tid){
+			for(size_t c = 0; c < 3; ++c){
+				clusterMisses += cache.access(indices[3*tid+c]) ? 1 : 0;
+			}
+		}
+		const float clusterAcmr = float(clusterMisses) / float(end - begin);
+		
+		boundaries.push_back(uint32_t(begin));
+		cache.flush();
+		size_t start = begin;
+		size_t misses = 0;
+		for(size_t tid = begin; tid < end; ++tid){
+			for(size_t c = 0; c < 3; ++c){
+				misses += cache.access(indices[3*tid+c]) ? 1 : 0;
+			}
+			const float acmr = float(misses) / float(tid - start + 1);
+			if(tid + 1 < end && acmr <= clusterAcmr * threshold){
+				boundaries.push_back(uint32_t(tid + 1));
+				cache.flush();
+				start = tid + 1;
+				misses = 0;
+			}
+		}
+	}
+	boundaries.push_back(uint32_t(trianglesCount));
+	
+	// Mesh centroid.
+	glm::vec3 meshCentroid(0.0f);
+	for(const uint32_t vid : indices){
+		meshCentroid += mesh.vertices[vid].pos;
+	}
+	meshCentroid /= float(indices.size());
+	
+	// Sort the clusters by how much they face away from the center: outer clusters are drawn first and occlude the others.
+	const size_t clustersCount = boundaries.size() - 1;
+	vector<float> sortKeys(clustersCount);
+	for(size_t cid = 0; cid < clustersCount; ++cid){
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+		for(size_t tid = boundaries[cid]; tid < boundaries[cid + 1]; ++tid){
+			const glm::vec3 & p0 = mesh.vertices[indices[3*tid+0]].pos;
+			const glm::vec3 & p1 = mesh.vertices[indices[3*tid+1]].pos;
+			const glm::vec3 & p2 = mesh.vertices[indices[3*tid+2]].pos;
+			// Area-weighted normal and centroid.
+			const glm::vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);
+			const float faceArea = glm::length(faceNormal);
+			normal += faceNormal;
+			centroid += (p0 + p1 + p2) * (faceArea / 3.0f);
+			area += faceArea;
+		}
+		centroid = area > 0.0f ? centroid / area : mesh.vertices[indices[3*boundaries[cid]]].pos;
+		const float normalLength = glm::length(normal);
+		sortKeys[cid] = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+	}
+	vector<uint32_t> order(clustersCount);
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b){
+		return sortKeys[a] > sortKeys[b];
+	});
+	
+	vector<uint32_t> sorted;
+	sorted.reserve(indices.size());
+	for(const uint32_t cid : order){
+		sorted.insert(sorted.end(), indices.begin() + 3 * boundaries[cid], indices.begin() + 3 * boundaries[cid + 1]);
+	}
+	indices.swap(sorted);
+}
+
+float MeshOptimizer::simplify(const Mesh & mesh, size_t targetIndicesCount, float targetError, std::vector<uint32_t> & indices){
+	indices = mesh.indices;
+	const size_t verticesCount = mesh.vertices.size();
+	if(indices.size() <= targetIndicesCount || verticesCount == 0){
+		return 0.0f;
+	}
+	
+	// Weld vertices sharing the same position, UV seams split them in multiple vertices.
+	vector<uint32_t> sortedVertices(verticesCount);
+	iota(sortedVertices.begin(), sortedVertices.end(), 0);
+	sort(sortedVertices.begin(), sortedVertices.end(), [&mesh](uint32_t a, uint32_t b){
+		const glm::vec3 & pa = mesh.vertices[a].pos;
+		const glm::vec3 & pb = mesh.vertices[b].pos;
+		return pa.x != pb.x ? pa.x < pb.x : (pa.y != pb.y ? pa.y < pb.y : (pa.z != pb.z ? pa.z < pb.z : a < b));
+	});
+	vector<uint32_t> positionIds(verticesCount);
+	vector<uint32_t> splitCounts(verticesCount, 0);
+	for(size_t sid = 0; sid < verticesCount; ++sid){
+		const uint32_t vid = sortedVertices[sid];
+		const bool shared = sid > 0 && mesh.vertices[sortedVertices[sid - 1]].pos == mesh.vertices[vid].pos;
+		positionIds[vid] = shared ? positionIds[sortedVertices[sid - 1]] : vid;
+		++splitCounts[positionIds[vid]];
+	}
+	
+	// Count the triangles using each edge between positions.
+	const auto edgeKey = [](uint32_t a, uint32_t b){
+		return (uint64_t(std::min(a, b)) << 32) | uint64_t(std::max(a, b));
+	};
+	unordered_map<uint64_t, uint32_t> edgeUses;
+	const auto countEdges = [&](){
+		edgeUses.clear();
+		edgeUses.reserve(indices.size());
+		for(size_t iid = 0; iid < indices.size(); ++iid){
+			const size_t next = iid % 3 == 2 ? iid - 2 : iid + 1;
+			++edgeUses[edgeKey(positionIds[indices[iid]], positionIds[indices[next]])];
+		}
+	};
+	countEdges();
+	
+	// Positions on a seam, a non-manifold edge or a junction of borders stay in place.
+	// Positions on a single border can only slide along it.
+	enum Kind : uint8_t { Manifold, Border, Locked };
+	vector<uint8_t> borderEdges(verticesCount, 0);
+	vector<uint8_t> kinds(verticesCount, Manifold);
+	for(const auto & edge : edgeUses){
+		const uint32_t a = uint32_t(edge.first >> 32);
+		const uint32_t b = uint32_t(edge.first & 0xFFFFFFFF);
+		if(edge.second == 1){
+			borderEdges[a] = uint8_t(std::min(borderEdges[a] + 1, 255));
+			borderEdges[b] = uint8_t(std::min(borderEdges[b] + 1, 255));
+		} else if(edge.second > 2){
+			kinds[a] = kinds[b] = Locked;
+		}
+	}
+	for(size_t vid = 0; vid < verticesCount; ++vid){
+		if(positionIds[vid] != vid){
+			continue;
+		}
+		if(splitCounts[vid] > 1 || (borderEdges[vid] != 0 && borderEdges[vid] != 2)){
+			kinds[vid] = Locked;
+		} else if(borderEdges[vid] == 2 && kinds[vid] != Locked){
+			kinds[vid] = Border;
+		}
+	}
+	
+	// Area-weighted quadrics of the faces planes, and of planes orthogonal to the faces along borders to keep their shape.
+	vector<Quadric> quadrics(verticesCount);
+	for(size_t tid = 0; tid < indices.size() / 3; ++tid){
+		const uint32_t ids[3] = { positionIds[indices[3*tid]], positionIds[indices[3*tid+1]], positionIds[indices[3*tid+2]] };
+		const glm::dvec3 p0(mesh.vertices[ids[0]].pos);
+		const glm::dvec3 p1(mesh.vertices[ids[1]].pos);
+		const glm::dvec3 p2(mesh.vertices[ids[2]].pos);
+		const glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		const double area = glm::length(normal);
+		if(area == 0.0){
+			continue;
+		}
+		const glm::dvec3 n = normal / area;
+		const Quadric face(n, -glm::dot(n, p0), 0.5 * area);
+		for(size_t c = 0; c < 3; ++c){
+			quadrics[ids[c]].add(face);
+			const uint32_t a = ids[c];
+			const uint32_t b = ids[(c + 1) % 3];
+			if(edgeUses[edgeKey(a, b)] != 1){
+				continue;
+			}
+			const glm::dvec3 pa(mesh.vertices[a].pos);
+			const glm::dvec3 edge = glm::dvec3(mesh.vertices[b].pos) - pa;
+			const double edgeLength = glm::length(edge);
+			if(edgeLength == 0.0){
+				continue;
+			}
+			const glm::dvec3 borderNormal = glm::normalize(glm::cross(edge / edgeLength, n));
+			const Quadric border(borderNormal, -glm::dot(borderNormal, pa), 10.0 * edgeLength * edgeLength);
+			quadrics[a].add(border);
+			quadrics[b].add(border);
+		}
+	}
+	
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+	const double errorLimit = double(targetError) * double(targetError);
+	double reachedError = 0.0;
+	vector<uint32_t> offsets;
+	vector<uint32_t> adjacentTriangles;
+	vector<Collapse> collapses;
+	vector<uint32_t> remap(verticesCount);
+	vector<bool> touched(verticesCount);
+	
+	while(indices.size() > targetIndicesCount){
+		const size_t trianglesCount = indices.size() / 3;
+		if(trianglesCount != mesh.indices.size() / 3){
+			countEdges();
+		}
+		
+		// Position-triangle adjacency.
+		offsets.assign(verticesCount + 1, 0);
+		for(const uint32_t vid : indices){
+			++offsets[positionIds[vid] + 1];
+		}
+		for(size_t vid = 0; vid < verticesCount; ++vid){
+			offsets[vid + 1] += offsets[vid];
+		}
+		adjacentTriangles.resize(indices.size());
+		vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for(size_t iid = 0; iid < indices.size(); ++iid){
+			adjacentTriangles[fill[positionIds[indices[iid]]]++] = uint32_t(iid / 3);
+		}
+		
+		// Cheapest allowed direction for each edge, interior edges are visited once.
+		collapses.clear();
+		for(size_t iid = 0; iid < indices.size(); ++iid){
+			const uint32_t a = indices[iid];
+			const uint32_t b = indices[iid % 3 == 2 ? iid - 2 : iid + 1];
+			const uint32_t pa = positionIds[a];
+			const uint32_t pb = positionIds[b];
+			const bool border = edgeUses[edgeKey(pa, pb)] == 1;
+			if(pa == pb || (pa > pb && !border)){
+				continue;
+			}
+			const bool toB = kinds[pa] == Manifold || (kinds[pa] == Border && border && kinds[pb] != Manifold);
+			const bool toA = kinds[pb] == Manifold || (kinds[pb] == Border && border && kinds[pa] != Manifold);
+			if(!toA && !toB){
+				continue;
+			}
+			Quadric merged = quadrics[pa];
+			merged.add(quadrics[pb]);
+			const double costB = merged.error(mesh.vertices[pb].pos);
+			const double costA = merged.error(mesh.vertices[pa].pos);
+			if(toB && (!toA || costB <= costA)){
+				collapses.push_back({a, b, costB});
+			} else {
+				collapses.push_back({b, a, costA});
+			}
+		}
+		sort(collapses.begin(), collapses.end(), [](const Collapse & c0, const Collapse & c1){
+			return c0.cost < c1.cost;
+		});
+		
+		// Apply collapses by increasing cost, each one freezing the neighborhood of the moved vertex until the next pass.
+		// Collapses remove two triangles, one on a border. Frozen vertices block cheap collapses, stop before reaching
+		// much more expensive ones: they will be cheaper after the next pass.
+		const size_t collapsesGoal = (trianglesCount - targetIndicesCount / 3) / 2 + 1;
+		const double passLimit = collapsesGoal < collapses.size() ? 1.5 * collapses[collapsesGoal].cost : errorLimit;
+		size_t collapsesCount = 0;
+		iota(remap.begin(), remap.end(), 0);
+		fill.assign(verticesCount, 0);
+		touched.assign(verticesCount, false);
+		for(const Collapse & collapse : collapses){
+			if(collapsesCount >= collapsesGoal || collapse.cost > errorLimit || collapse.cost > passLimit){
+				break;
+			}
+			const uint32_t from = positionIds[collapse.from];
+			const uint32_t to = positionIds[collapse.to];
+			if(touched[from] || touched[to]){
+				continue;
+			}
+			// Reject collapses flipping one of the remaining triangles.
+			bool flips = false;
+			for(uint32_t aid = offsets[from]; aid < offsets[from + 1] && !flips; ++aid){
+				const uint32_t tid = adjacentTriangles[aid];
+				uint32_t ids[3] = { positionIds[indices[3*tid]], positionIds[indices[3*tid+1]], positionIds[indices[3*tid+2]] };
+				if(ids[0] == to || ids[1] == to || ids[2] == to){
+					continue;
+				}
+				const glm::vec3 before = glm::cross(mesh.vertices[ids[1]].pos - mesh.vertices[ids[0]].pos, mesh.vertices[ids[2]].pos - mesh.vertices[ids[0]].pos);
+				for(uint32_t & id : ids){
+					id = id == from ? to : id;
+				}
+				const glm::vec3 after = glm::cross(mesh.vertices[ids[1]].pos - mesh.vertices[ids[0]].pos, mesh.vertices[ids[2]].pos - mesh.vertices[ids[0]].pos);
+				flips = glm::dot(before, after) <= 0.0f;
+			}
+			if(flips){
+				continue;
+			}
+			for(uint32_t aid = offsets[from]; aid < offsets[from + 1]; ++aid){
+				const uint32_t tid = adjacentTriangles[aid];
+				for(size_t c = 0; c < 3; ++c){
+					touched[positionIds[indices[3*tid+c]]] = true;
+				}
+			}
+			remap[collapse.from] = collapse.to;
+			quadrics[to].add(quadrics[from]);
+			reachedError = std::max(reachedError, collapse.cost);
+			++collapsesCount;
+		}
+		if(collapsesCount == 0){
+			break;
+		}
+		
+		// Update the triangles and drop the degenerate ones.
+		size_t kept = 0;
+		for(size_t tid = 0; tid < trianglesCount; ++tid){
+			const uint32_t v0 = remap[indices[3*tid]];
+			const uint32_t v1 = remap[indices[3*tid+1]];
+			const uint32_t v2 = remap[indices[3*tid+2]];
+			if(positionIds[v0] == positionIds[v1] || positionIds[v1] == positionIds[v2] || positionIds[v2] == positionIds[v0]){
+				continue;
+			}
+			indices[3*kept] = v0;
+			indices[3*kept+1] = v1;
+			indices[3*kept+2] = v2;
+			++kept;
+		}
+		indices.resize(3 * kept);
+	}
+	return float(std::sqrt(reachedError));
+}
+
+void MeshOptimizer::buildMeshlets(Mesh & mesh, size_t maxVertices, size_t maxTriangles, float coneWeight, std::vector<Meshlet> & meshlets){
+	meshlets.clear();
+	const size_t trianglesCount = mesh.indices.size() / 3;
+	if(trianglesCount == 0){
+		return;
+	}
+	const size_t verticesCount = mesh.vertices.size();
+	
+	// Vertex-triangle adjacency, stored contiguously per vertex.
+	vector<uint32_t> offsets(verticesCount + 1, 0);
+	for(const uint32_t vid : mesh.indices){
+		++offsets[vid + 1];
+	}
+	for(size_t vid = 0; vid < verticesCount; ++vid){
+		offsets[vid + 1] += offsets[vid];
+	}
+	vector<uint32_t> adjacentTriangles(mesh.indices.size());
+	vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for(size_t iid = 0; iid < mesh.indices.size(); ++iid){
+		adjacentTriangles[fill[mesh.indices[iid]]++] = uint32_t(iid / 3);
+	}
+	
+	vector<glm::vec3> normals(trianglesCount, glm::vec3(0.0f));
+	for(size_t tid = 0; tid < trianglesCount; ++tid){
+		const glm::vec3 & p0 = mesh.vertices[mesh.indices[3*tid]].pos;
+		const glm::vec3 & p1 = mesh.vertices[mesh.indices[3*tid+1]].pos;
+		const glm::vec3 & p2 = mesh.vertices[mesh.indices[3*tid+2]].pos;
+		const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		const float length = glm::length(normal);
+		normals[tid] = length > 0.0f ? normal / length : normal;
+	}
+	
+	// Grow each meshlet from the first remaining triangle in the current order, by adding the neighbor triangle
+	// that brings the fewest new vertices and deviates the least from the meshlet average normal.
+	const uint32_t none = 0xFFFFFFFF;
+	vector<bool> emitted(trianglesCount, false);
+	vector<uint32_t> vertexStamps(verticesCount, 0);
+	vector<uint32_t> candidateStamps(trianglesCount, 0);
+	vector<uint32_t> candidates;
+	vector<uint32_t> reordered;
+	reordered.reserve(mesh.indices.size());
+	uint32_t stamp = 0;
+	size_t seed = 0;
+	while(true){
+		while(seed < trianglesCount && emitted[seed]){
+			++seed;
+		}
+		if(seed == trianglesCount){
+			break;
+		}
+		++stamp;
+		Meshlet meshlet;
+		meshlet.firstIndex = uint32_t(reordered.size());
+		size_t meshletVertices = 0;
+		size_t meshletTriangles = 0;
+		glm::vec3 normalSum(0.0f);
+		candidates.clear();
+		
+		uint32_t next = uint32_t(seed);
+		while(next != none){
+			emitted[next] = true;
+			++meshletTriangles;
+			normalSum += normals[next];
+			for(size_t c = 0; c < 3; ++c){
+				const uint32_t vid = mesh.indices[3*next+c];
+				reordered.push_back(vid);
+				if(vertexStamps[vid] == stamp){
+					continue;
+				}
+				vertexStamps[vid] = stamp;
+				++meshletVertices;
+				for(uint32_t aid = offsets[vid]; aid < offsets[vid + 1]; ++aid){
+					const uint32_t tid = adjacentTriangles[aid];
+					if(!emitted[tid] && candidateStamps[tid] != stamp){
+						candidateStamps[tid] = stamp;
+						candidates.push_back(tid);
+					}
+				}
+			}
+			if(meshletTriangles == maxTriangles){
+				break;
+			}
+			
+			const float normalLength = glm::length(normalSum);
+			const glm::vec3 axis = normalLength > 0.0f ? normalSum / normalLength : normalSum;
+			float bestScore = 0.0f;
+			next = none;
+			size_t kept = 0;
+			for(const uint32_t tid : candidates){
+				if(emitted[tid]){
+					continue;
+				}
+				candidates[kept++] = tid;
+				size_t added = 0;
+				for(size_t c = 0; c < 3; ++c){
+					added += vertexStamps[mesh.indices[3*tid+c]] != stamp ? 1 : 0;
+				}
+				if(meshletVertices + added > maxVertices){
+					continue;
+				}
+				const float score = float(added) + coneWeight * (1.0f - glm::dot(normals[tid], axis));
+				if(next == none || score < bestScore){
+					bestScore = score;
+					next = tid;
+				}
+			}
+			candidates.resize(kept);
+		}
+		meshlet.indicesCount = uint32_t(reordered.size()) - meshlet.firstIndex;
+		meshlets.push_back(meshlet);
+	}
+	mesh.indices.swap(reordered);
+	
+	for(Meshlet & meshlet : meshlets){
+		// Bounding sphere centered on the bounding box.
+		glm::vec3 mini = mesh.vertices[mesh.indices[meshlet.firstIndex]].pos;
+		glm::vec3 maxi = mini;
+		for(uint32_t iid = meshlet.firstIndex; iid < meshlet.firstIndex + meshlet.indicesCount; ++iid){
+			mini = glm::min(mini, mesh.vertices[mesh.indices[iid]].pos);
+			maxi = glm::max(maxi, mesh.vertices[mesh.indices[iid]].pos);
+		}
+		meshlet.center = 0.5f * (mini + maxi);
+		meshlet.radius = 0.0f;
+		for(uint32_t iid = meshlet.firstIndex; iid < meshlet.firstIndex + meshlet.indicesCount; ++iid){
+			meshlet.radius = std::max(meshlet.radius, glm::length(mesh.vertices[mesh.indices[iid]].pos - meshlet.center));
+		}
+		
+		// Normal cone: average direction, and widest deviation from it.
+		vector<glm::vec3> meshletNormals;
+		glm::vec3 axis(0.0f);
+		for(uint32_t iid = meshlet.firstIndex; iid < meshlet.firstIndex + meshlet.indicesCount; iid += 3){
+			const glm::vec3 & p0 = mesh.vertices[mesh.indices[iid]].pos;
+			const glm::vec3 & p1 = mesh.vertices[mesh.indices[iid+1]].pos;
+			const glm::vec3 & p2 = mesh.vertices[mesh.indices[iid+2]].pos;
+			const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			const float length = glm::length(normal);
+			if(length > 0.0f){
+				meshletNormals.push_back(normal / length);
+				axis += meshletNormals.back();
+			}
+		}
+		const float axisLength = glm::length(axis);
+		float minDot = 1.0f;
+		for(const glm::vec3 & normal : meshletNormals){
+			minDot = std::min(minDot, glm::dot(normal, axis / axisLength));
+		}
+		// Cones wider than a hemisphere never face away from the viewer.
+		if(axisLength == 0.0f || minDot <= 0.1f){
+			meshlet.coneAxis = glm::vec3(0.0f);
+			meshlet.coneCutoff = 1.0f;
+		} else {
+			meshlet.coneAxis = axis / axisLength;
+			meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef MeshOptimizer_h
+#define MeshOptimizer_h
+
+#include "MeshUtilities.hpp"
+
+class MeshOptimizer {
+
+public:
+	
+	struct VertexCacheStatistics {
+		float acmr = 0.0f; ///< Average cache miss ratio: transformed vertices per triangle.
+		float atvr = 0.0f; ///< Average transform to vertex ratio: transformed vertices per referenced vertex.
+	};
+	
+	struct VertexFetchStatistics {
+		size_t bytesFetched = 0; ///< Bytes read from memory, in whole cache lines.
+		float bytesPerVertex = 0.0f; ///< Bytes read per referenced vertex.
+		float overfetch = 0.0f; ///< Ratio of the bytes read to the size of the referenced vertices.
+	};
+	
+	/// Simulate a FIFO post-transform vertex cache of the given size on the triangle list.
+	static VertexCacheStatistics analyzeVertexCache(const std::vector<uint32_t> & indices, size_t verticesCount, unsigned int cacheSize);
+	
+	/// Reorder triangles for post-transform vertex cache locality (Tipsify).
+	/// If the overdraw threshold is above 1, triangles are then grouped in clusters sorted from the outside in,
+	/// the threshold being the ACMR degradation allowed in exchange (1.05: 5% worse).
+	static void optimizeVertexCache(Mesh & mesh, unsigned int cacheSize, float overdrawThreshold);
+	
+	/// Simulate the memory reads of the vertex fetch: each vertex missing from a post-transform cache of the given size
+	/// loads the 64 bytes lines it spans, through a FIFO cache of 128 lines.
+	static VertexFetchStatistics analyzeVertexFetch(const std::vector<uint32_t> & indices, size_t verticesCount, size_t vertexSize, unsigned int cacheSize);
+	
+	/// Renumber vertices in order of first use by the index buffer, dropping unreferenced ones.
+	static void optimizeVertexFetch(Mesh & mesh, unsigned int cacheSize);
+	
+	/// Simplify the triangles by quadric error edge collapses, until at most the target count of indices remain
+	/// or the next collapse would move the surface by more than the target error (in mesh units).
+	/// Vertices are collapsed onto existing ones, so the result indexes the mesh vertices. UV seams and borders are preserved.
+	/// Returns the error reached.
+	static float simplify(const Mesh & mesh, size_t targetIndicesCount, float targetError, std::vector<uint32_t> & indices);
+	
+	/// Group the triangles in meshlets using at most the given numbers of vertices and triangles, reordering the index buffer meshlet by meshlet.
+	/// The cone weight favors triangles aligned with the meshlet average normal over vertex reuse, giving tighter normal cones.
+	static void buildMeshlets(Mesh & mesh, size_t maxVertices, size_t maxTriangles, float coneWeight, std::vector<Meshlet> & meshlets);
+	
+private:
+	
+	/// Tipsify reordering, returning the index of the first triangle of each cluster (cache flushes).
+	static std::vector<uint32_t> tipsify(const std::vector<uint32_t> & indices, size_t verticesCount, unsigned int cacheSize, std::vector<uint32_t> & reordered);
+	
+	/// Split clusters where the local ACMR is good enough, then sort them by decreasing occlusion potential.
+	static void optimizeOverdraw(const Mesh & mesh, const std::vector<uint32_t> & clusters, unsigned int cacheSize, float threshold, std::vector<uint32_t> & indices);
+	
+};
+
+#endif
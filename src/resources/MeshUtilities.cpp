@@ -1,192 +1,499 @@
 #include "MeshUtilities.hpp"
 #include "Resources.hpp"
+#include "../ThreadUtilities.hpp"
 
-#include <fstream>
-#include <sstream>
+#include <glm/gtc/packing.hpp>
+#include <algorithm>
 #include <cstddef>
-#include <map>
+#include <cstdlib>
+#include <cstring>
 
 using namespace std;
 
-void MeshUtilities::loadObj(const std::string & path, Mesh & mesh, MeshUtilities::LoadMode mode){
+// Face corner: one-based position, uv and normal indices, zero when absent.
+struct Corner {
+	unsigned int p;
+	unsigned int t;
+	unsigned int n;
 	
-	std::stringstream in(Resources::loadStringFromExternalFile(path));
+	bool operator==(const Corner & other) const {
+		return p == other.p && t == other.t && n == other.n;
+	}
 	
-	//Init the mesh.
-	mesh.indices.clear();
-	mesh.vertices.clear();
-	// Init temporary vectors.
-	vector<glm::vec3> positions_temp;
-	vector<glm::vec3> normals_temp;
-	vector<glm::vec2> texcoords_temp;
-	vector<string> faces_temp;
+	// Pack the three indices in a 64 bits integer and mix the bits.
+	uint64_t hash() const {
+		uint64_t key = uint64_t(p) ^ (uint64_t(t) << 21) ^ (uint64_t(n) << 42);
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		return key;
+	}
+};
 
-	string res;
+// Open-addressing (linear probing) table from corners to vertex indices.
+// Sized once for a known number of insertions, it never grows.
+class CornerTable {
+	
+public:
+	
+	CornerTable(size_t maxCount){
+		size_t capacity = 16;
+		while(capacity < 2 * maxCount){
+			capacity <<= 1;
+		}
+		_mask = capacity - 1;
+		// A position index of zero marks an empty slot, as OBJ indices start at one.
+		_entries.resize(capacity, Entry{ {0, 0, 0}, 0 });
+	}
+	
+	/// Return the index associated to the corner, inserting the given one if the corner is new.
+	unsigned int insert(const Corner & corner, unsigned int index, bool & inserted){
+		size_t slot = size_t(corner.hash()) & _mask;
+		while(_entries[slot].corner.p != 0){
+			if(_entries[slot].corner == corner){
+				inserted = false;
+				return _entries[slot].index;
+			}
+			slot = (slot + 1) & _mask;
+		}
+		_entries[slot].corner = corner;
+		_entries[slot].index = index;
+		inserted = true;
+		return index;
+	}
+	
+private:
+	
+	struct Entry {
+		Corner corner;
+		unsigned int index;
+	};
+	
+	std::vector<Entry> _entries;
+	size_t _mask;
+};
 
-	// Iterate over the lines of the file.
-	while(!in.eof()){
-		getline(in,res);
+static inline bool isBlank(const char c){
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
 
-		// Ignore the line if it is too short or a comment.
-		if(res.empty() || res[0] == '#' || res.size()<2){
-			continue;
+static inline const char * skipBlanks(const char * it, const char * end){
+	while(it < end && isBlank(*it)){
+		++it;
+	}
+	return it;
+}
+
+static inline const char * tokenEnd(const char * it, const char * end){
+	while(it < end && !isBlank(*it)){
+		++it;
+	}
+	return it;
+}
+
+// Parse the next whitespace-separated float of the line, advancing the cursor.
+static bool parseFloat(const char *& it, const char * end, float & value){
+	static const float powersOfTen[11] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+	
+	const char * start = skipBlanks(it, end);
+	const char * stop = tokenEnd(start, end);
+	if(start == stop){
+		return false;
+	}
+	it = stop;
+	
+	// Fast path: [+-]digits[.digits], exact as long as the mantissa and the power of ten are both representable.
+	const char * c = start;
+	const bool negative = (*c == '-');
+	if(*c == '-' || *c == '+'){
+		++c;
+	}
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int fractionDigits = 0;
+	bool hasDot = false;
+	for(; c < stop && digits < 19; ++c){
+		if(*c >= '0' && *c <= '9'){
+			mantissa = mantissa * 10 + uint64_t(*c - '0');
+			++digits;
+			fractionDigits += hasDot ? 1 : 0;
+		} else if(*c == '.' && !hasDot){
+			hasDot = true;
+		} else {
+			break;
 		}
-		//We want to split the content of the line at spaces, use a stringstream directly
-		stringstream ss(res);
-		vector<string> tokens;
-		string token;
-		while(ss >> token){
-			tokens.push_back(token);
+	}
+	if(c == stop && digits > 0 && mantissa <= (1u << 24) && fractionDigits <= 10){
+		value = float(mantissa) / powersOfTen[fractionDigits];
+		value = negative ? -value : value;
+		return true;
+	}
+	
+	// Slow path (exponents, long mantissas, special values): rely on the C library.
+	char buffer[64];
+	const size_t length = std::min(size_t(stop - start), sizeof(buffer) - 1);
+	memcpy(buffer, start, length);
+	buffer[length] = '\0';
+	char * parsedEnd = nullptr;
+	value = strtof(buffer, &parsedEnd);
+	return parsedEnd != buffer;
+}
+
+// Parse the leading digits of a face index.
+static inline unsigned int parseIndex(const char *& it, const char * end){
+	unsigned int index = 0;
+	while(it < end && *it >= '0' && *it <= '9'){
+		index = index * 10 + unsigned(*it - '0');
+		++it;
+	}
+	return index;
+}
+
+// Parse the next face corner of the line ("p", "p/t", "p/t/n" or "p//n"), advancing the cursor.
+static bool parseCorner(const char *& it, const char * end, Corner & corner){
+	const char * start = skipBlanks(it, end);
+	const char * stop = tokenEnd(start, end);
+	if(start == stop){
+		return false;
+	}
+	it = stop;
+	
+	const char * c = start;
+	corner.p = parseIndex(c, stop);
+	if(corner.p == 0){
+		return false;
+	}
+	// Missing uv and normal indices reuse the previous one.
+	corner.t = corner.n = corner.p;
+	const char * firstSlash = static_cast<const char *>(memchr(c, '/', stop - c));
+	if(firstSlash == nullptr){
+		return true;
+	}
+	c = firstSlash + 1;
+	corner.t = corner.n = parseIndex(c, stop);
+	const char * lastSlash = firstSlash;
+	for(const char * s = c; s < stop; ++s){
+		lastSlash = (*s == '/') ? s : lastSlash;
+	}
+	if(lastSlash != firstSlash){
+		c = lastSlash + 1;
+		corner.n = parseIndex(c, stop);
+	}
+	return true;
+}
+
+// Elements of an OBJ file, or of a chunk of it.
+struct ObjElements {
+	vector<glm::vec3> positions;
+	vector<glm::vec3> normals;
+	vector<glm::vec2> texcoords;
+	vector<Corner> corners;
+};
+
+// Parse the lines in [begin, end), begin being the start of a line.
+static void parseObjLines(const char * begin, const char * end, ObjElements & elements){
+	
+	// First pass: count the elements to avoid any reallocation while parsing.
+	size_t positionsCount = 0;
+	size_t normalsCount = 0;
+	size_t texcoordsCount = 0;
+	size_t facesCount = 0;
+	for(const char * line = begin; line < end;){
+		const char * lineEnd = static_cast<const char *>(memchr(line, '\n', end - line));
+		lineEnd = lineEnd ? lineEnd : end;
+		if(lineEnd - line >= 2){
+			if(line[0] == 'v'){
+				positionsCount += isBlank(line[1]) ? 1 : 0;
+				normalsCount += (line[1] == 'n') ? 1 : 0;
+				texcoordsCount += (line[1] == 't') ? 1 : 0;
+			} else if(line[0] == 'f'){
+				facesCount += isBlank(line[1]) ? 1 : 0;
+			}
 		}
-		if(tokens.size() < 1){
+		line = lineEnd + 1;
+	}
+	elements.positions.reserve(positionsCount);
+	elements.normals.reserve(normalsCount);
+	elements.texcoords.reserve(texcoordsCount);
+	elements.corners.reserve(3 * facesCount);
+
+	// Iterate over the lines of the file.
+	for(const char * line = begin; line < end;){
+		const char * lineEnd = static_cast<const char *>(memchr(line, '\n', end - line));
+		lineEnd = lineEnd ? lineEnd : end;
+		const char * it = line;
+		line = lineEnd + 1;
+		
+		// Ignore the line if it is too short or a comment.
+		if(lineEnd - it < 2 || it[0] == '#'){
 			continue;
 		}
+		// Extract the keyword.
+		it = skipBlanks(it, lineEnd);
+		const char * keyword = it;
+		it = tokenEnd(it, lineEnd);
+		const size_t keywordSize = it - keyword;
+		
 		// Check what kind of element the line represent.
-		if (tokens[0] == "v") { // Vertex position
+		if(keywordSize == 1 && keyword[0] == 'v'){ // Vertex position
 			// We need 3 coordinates.
-			if(tokens.size() < 4){
-				continue;
+			glm::vec3 pos;
+			if(parseFloat(it, lineEnd, pos.x) && parseFloat(it, lineEnd, pos.y) && parseFloat(it, lineEnd, pos.z)){
+				elements.positions.push_back(pos);
 			}
-			glm::vec3 pos = glm::vec3(stof(tokens[1],NULL),stof(tokens[2],NULL),stof(tokens[3],NULL));
-			positions_temp.push_back(pos);
 			
-		} else if (tokens[0] == "vn"){ // Vertex normal
+		} else if(keywordSize == 2 && keyword[0] == 'v' && keyword[1] == 'n'){ // Vertex normal
 			// We need 3 coordinates.
-			if(tokens.size() < 4){
-				continue;
+			glm::vec3 nor;
+			if(parseFloat(it, lineEnd, nor.x) && parseFloat(it, lineEnd, nor.y) && parseFloat(it, lineEnd, nor.z)){
+				elements.normals.push_back(nor);
 			}
-			glm::vec3 nor = glm::vec3(stof(tokens[1],NULL),stof(tokens[2],NULL),stof(tokens[3],NULL));
-			normals_temp.push_back(nor);
 			
-		} else if (tokens[0] == "vt") { // Vertex UV
+		} else if(keywordSize == 2 && keyword[0] == 'v' && keyword[1] == 't'){ // Vertex UV
 			// We need 2 coordinates.
-			if(tokens.size() < 3){
-				continue;
+			glm::vec2 uv;
+			if(parseFloat(it, lineEnd, uv.x) && parseFloat(it, lineEnd, uv.y)){
+				elements.texcoords.push_back(uv);
 			}
-			glm::vec2 uv = glm::vec2(stof(tokens[1],NULL),stof(tokens[2],NULL));
-			texcoords_temp.push_back(uv);
 			
-		} else if (tokens[0] == "f") { // Face indices.
+		} else if(keywordSize == 1 && keyword[0] == 'f'){ // Face indices.
 			// We need 3 elements, each containing at most three indices.
-			if(tokens.size() < 4){
-				continue;
+			Corner c0, c1, c2;
+			if(parseCorner(it, lineEnd, c0) && parseCorner(it, lineEnd, c1) && parseCorner(it, lineEnd, c2)){
+				elements.corners.push_back(c0);
+				elements.corners.push_back(c1);
+				elements.corners.push_back(c2);
 			}
-			faces_temp.push_back(tokens[1]);
-			faces_temp.push_back(tokens[2]);
-			faces_temp.push_back(tokens[3]);
+		}
+		// Ignore s, l, g, matl or others
+	}
+}
 
-		} else { // Ignore s, l, g, matl or others
-			continue;
+// Concatenate the chunks elements in order, each chunk being copied at an offset given by prefix sums.
+static void mergeObjChunks(vector<ObjElements> & chunks, unsigned int threads, ObjElements & elements){
+	if(chunks.size() == 1){
+		elements = std::move(chunks[0]);
+		return;
+	}
+	struct Offsets {
+		size_t positions = 0;
+		size_t normals = 0;
+		size_t texcoords = 0;
+		size_t corners = 0;
+	};
+	vector<Offsets> offsets(chunks.size() + 1);
+	for(size_t cid = 0; cid < chunks.size(); ++cid){
+		offsets[cid+1].positions = offsets[cid].positions + chunks[cid].positions.size();
+		offsets[cid+1].normals = offsets[cid].normals + chunks[cid].normals.size();
+		offsets[cid+1].texcoords = offsets[cid].texcoords + chunks[cid].texcoords.size();
+		offsets[cid+1].corners = offsets[cid].corners + chunks[cid].corners.size();
+	}
+	elements.positions.resize(offsets.back().positions);
+	elements.normals.resize(offsets.back().normals);
+	elements.texcoords.resize(offsets.back().texcoords);
+	elements.corners.resize(offsets.back().corners);
+	
+	ThreadUtilities::parallelFor(chunks.size(), threads, [&chunks, &offsets, &elements](unsigned int, size_t begin, size_t end){
+		for(size_t cid = begin; cid < end; ++cid){
+			ObjElements & chunk = chunks[cid];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), elements.positions.begin() + offsets[cid].positions);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), elements.normals.begin() + offsets[cid].normals);
+			std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), elements.texcoords.begin() + offsets[cid].texcoords);
+			std::copy(chunk.corners.begin(), chunk.corners.end(), elements.corners.begin() + offsets[cid].corners);
+			chunk = ObjElements();
+		}
+	});
+}
+
+// Assign to each corner the index of its vertex, vertices being created in order of first use.
+// uniqueCorners receives, for each vertex, the first corner referencing it.
+static void deduplicateCorners(const vector<Corner> & corners, unsigned int threads, vector<uint32_t> & indices, vector<uint32_t> & uniqueCorners){
+	const size_t count = corners.size();
+	indices.resize(count);
+	uniqueCorners.clear();
+	
+	if(threads == 1){
+		// Keep track of previously encountered (position,uv,normal), there are at most as many as corners.
+		CornerTable table(count);
+		for(size_t i = 0; i < count; ++i){
+			bool inserted = false;
+			indices[i] = table.insert(corners[i], (unsigned int)uniqueCorners.size(), inserted);
+			if(inserted){
+				uniqueCorners.push_back((uint32_t)i);
+			}
+		}
+		return;
+	}
+	
+	// Each thread owns the corners whose hash falls in its shard, and finds the first occurrence of each of them.
+	// The high bits of the hash are used, the low ones index the table.
+	// Corners are bucketed by shard beforehand, in increasing order, counting them per range first.
+	vector<uint32_t> shards(count);
+	vector<size_t> shardOffsets(size_t(threads) * threads + 1, 0);
+	ThreadUtilities::parallelFor(count, threads, [&corners, &shards, &shardOffsets, threads](unsigned int rid, size_t begin, size_t end){
+		for(size_t i = begin; i < end; ++i){
+			shards[i] = uint32_t((corners[i].hash() >> 32) % threads);
+			++shardOffsets[size_t(shards[i]) * threads + rid + 1];
+		}
+	});
+	// Offsets are ordered by shard then by range.
+	for(size_t sid = 1; sid < shardOffsets.size(); ++sid){
+		shardOffsets[sid] += shardOffsets[sid - 1];
+	}
+	vector<uint32_t> buckets(count);
+	ThreadUtilities::parallelFor(count, threads, [&shards, &shardOffsets, &buckets, threads](unsigned int rid, size_t begin, size_t end){
+		vector<size_t> offsets(threads);
+		for(size_t shard = 0; shard < threads; ++shard){
+			offsets[shard] = shardOffsets[shard * threads + rid];
+		}
+		for(size_t i = begin; i < end; ++i){
+			buckets[offsets[shards[i]]++] = uint32_t(i);
 		}
+	});
+	vector<uint32_t> firstOccurrences(count);
+	ThreadUtilities::parallelFor(threads, threads, [&corners, &shardOffsets, &buckets, &firstOccurrences, threads](unsigned int, size_t begin, size_t end){
+		for(size_t shard = begin; shard < end; ++shard){
+			const size_t first = shardOffsets[shard * threads];
+			const size_t last = shardOffsets[(shard + 1) * threads];
+			CornerTable table(last - first);
+			for(size_t bid = first; bid < last; ++bid){
+				const uint32_t i = buckets[bid];
+				bool inserted = false;
+				firstOccurrences[i] = table.insert(corners[i], (unsigned int)i, inserted);
+			}
+		}
+	});
+	
+	// Number the first occurrences in order: count them per range, then offset each range by the prefix sum.
+	vector<size_t> rangeOffsets(threads + 1, 0);
+	ThreadUtilities::parallelFor(count, threads, [&firstOccurrences, &rangeOffsets](unsigned int rid, size_t begin, size_t end){
+		size_t newCount = 0;
+		for(size_t i = begin; i < end; ++i){
+			newCount += (firstOccurrences[i] == i) ? 1 : 0;
+		}
+		rangeOffsets[rid + 1] = newCount;
+	});
+	for(size_t rid = 0; rid < threads; ++rid){
+		rangeOffsets[rid + 1] += rangeOffsets[rid];
 	}
+	uniqueCorners.resize(rangeOffsets.back());
+	ThreadUtilities::parallelFor(count, threads, [&firstOccurrences, &rangeOffsets, &indices, &uniqueCorners](unsigned int rid, size_t begin, size_t end){
+		size_t vid = rangeOffsets[rid];
+		for(size_t i = begin; i < end; ++i){
+			if(firstOccurrences[i] == i){
+				indices[i] = (uint32_t)vid;
+				uniqueCorners[vid] = (uint32_t)i;
+				++vid;
+			}
+		}
+	});
+	// Other corners reuse the vertex of their first occurrence.
+	ThreadUtilities::parallelFor(count, threads, [&firstOccurrences, &indices](unsigned int, size_t begin, size_t end){
+		for(size_t i = begin; i < end; ++i){
+			if(firstOccurrences[i] != i){
+				indices[i] = indices[firstOccurrences[i]];
+			}
+		}
+	});
+}
 
+// Query the position/uv/normal associated to a corner.
+static inline void fillVertex(const ObjElements & elements, const Corner & corner, Vertex & vertex){
+	// Positions (we are sure they exist).
+	vertex.pos = elements.positions[corner.p-1];
+	// UVs (second index).
+	if(corner.t > 0 && !elements.texcoords.empty()){
+		vertex.texCoord = elements.texcoords[corner.t-1];
+	}
+	// Normals (third index, in all cases).
+	if(corner.n > 0 && !elements.normals.empty()){
+		vertex.normal = elements.normals[corner.n-1];
+	}
+}
+
+void MeshUtilities::loadObj(const std::string & path, Mesh & mesh, MeshUtilities::LoadMode mode){
+	
+	MappedFile file(path);
+	
+	//Init the mesh.
+	mesh.indices.clear();
+	mesh.vertices.clear();
+	if(!file.valid()){
+		return;
+	}
+	const char * const begin = file.data();
+	const char * const end = begin + file.size();
+	const unsigned int threads = ThreadUtilities::threadCount();
+	
+	// Split the file in chunks starting at line boundaries, small files are parsed in one go.
+	const size_t minChunkSize = 256 * 1024;
+	const size_t chunksCount = std::max(size_t(1), std::min(size_t(threads), file.size() / minChunkSize));
+	vector<const char *> bounds(chunksCount + 1, end);
+	bounds[0] = begin;
+	for(size_t cid = 1; cid < chunksCount; ++cid){
+		const char * split = std::max(begin + file.size() * cid / chunksCount, bounds[cid-1]);
+		const char * lineEnd = static_cast<const char *>(memchr(split, '\n', end - split));
+		bounds[cid] = lineEnd ? lineEnd + 1 : end;
+	}
+	// Parse each chunk separately, then merge them in order.
+	vector<ObjElements> chunks(chunksCount);
+	ThreadUtilities::parallelFor(chunksCount, threads, [&chunks, &bounds](unsigned int, size_t begin, size_t end){
+		for(size_t cid = begin; cid < end; ++cid){
+			parseObjLines(bounds[cid], bounds[cid+1], chunks[cid]);
+		}
+	});
+	ObjElements elements;
+	mergeObjChunks(chunks, threads, elements);
+	
 	// If no vertices, end.
-	if(positions_temp.size() == 0){
+	if(elements.positions.size() == 0){
 			return;
 	}
 
-	// Does the mesh have UV or normal coordinates ?
-	bool hasUV = texcoords_temp.size()>0;
-	bool hasNormals = normals_temp.size()>0;
-
 	// Depending on the chosen extraction mode, we fill the mesh arrays accordingly.
 	if (mode == MeshUtilities::Points){
 		// Mode: Points
 		// In this mode, we don't care about faces. We simply associate each vertex/normal/uv in the same order.
-		mesh.vertices.resize(positions_temp.size());
-		for(size_t vid = 0; vid < positions_temp.size(); ++vid){
-			mesh.vertices[vid].pos = positions_temp[vid];
-			if(hasNormals){
-				mesh.vertices[vid].normal = normals_temp[vid];
+		// Attributes lists can be shorter than the positions list, leave the missing ones at zero.
+		mesh.vertices.resize(elements.positions.size());
+		for(size_t vid = 0; vid < elements.positions.size(); ++vid){
+			mesh.vertices[vid].pos = elements.positions[vid];
+			if(vid < elements.normals.size()){
+				mesh.vertices[vid].normal = elements.normals[vid];
 			}
-			if(hasUV){
-				mesh.vertices[vid].texCoord = texcoords_temp[vid];
+			if(vid < elements.texcoords.size()){
+				mesh.vertices[vid].texCoord = elements.texcoords[vid];
 			}
 		}
 
 	} else if(mode == MeshUtilities::Expanded){
 		// Mode: Expanded
 		// In this mode, vertices are all duplicated. Each face has its set of 3 vertices, not shared with any other face.
-		
+		mesh.vertices.resize(elements.corners.size());
+		mesh.indices.resize(elements.corners.size());
 		// For each face, query the needed positions, normals and uvs, and add them to the mesh structure.
-		for(size_t i = 0; i < faces_temp.size(); i++){
-			string str = faces_temp[i];
-			size_t foundF = str.find_first_of("/");
-			size_t foundL = str.find_last_of("/");
-			
-			// Positions (we are sure they exist).
-			long ind1 = stol(str.substr(0,foundF))-1;
-			mesh.vertices.emplace_back();
-			mesh.vertices.back().pos = positions_temp[ind1];
-
-			// UVs (second index).
-			if(hasUV){
-				long ind2 = stol(str.substr(foundF+1,foundL))-1;
-				mesh.vertices.back().texCoord = texcoords_temp[ind2];
+		ThreadUtilities::parallelFor(elements.corners.size(), threads, [&elements, &mesh](unsigned int, size_t begin, size_t end){
+			for(size_t i = begin; i < end; ++i){
+				fillVertex(elements, elements.corners[i], mesh.vertices[i]);
+				//Indices (simply a vector of increasing integers).
+				mesh.indices[i] = (unsigned int)i;
 			}
-
-			// Normals (third index, in all cases).
-			if(hasNormals){
-				long ind3 = stol(str.substr(foundL+1))-1;
-				mesh.vertices.back().normal = normals_temp[ind3];
-			}
-			
-			//Indices (simply a vector of increasing integers).
-			mesh.indices.push_back((unsigned int)i);
-		}
+		});
 
 	} else if (mode == MeshUtilities::Indexed){
 		// Mode: Indexed
 		// In this mode, vertices are only duplicated if they were already used in a previous face with a different set of uv/normal coordinates.
+		vector<uint32_t> uniqueCorners;
+		deduplicateCorners(elements.corners, threads, mesh.indices, uniqueCorners);
 		
-		// Keep track of previously encountered (position,uv,normal).
-		map<string,unsigned int> indices_used;
-
-		//Positions
-		unsigned int maxInd = 0;
-		for(size_t i = 0; i < faces_temp.size(); i++){
-			
-			string str = faces_temp[i];
-
-			//Does the association of attributs already exists ?
-			if(indices_used.count(str)>0){
-				// Just store the index in the indices vector.
-				mesh.indices.push_back(indices_used[str]);
-				// Go to next face.
-				continue;
-			}
-
-			// else, query the associated position/uv/normal, store it, update the indices vector and the list of used elements.
-			size_t foundF = str.find_first_of("/");
-			size_t foundL = str.find_last_of("/");
-			
-			//Positions (we are sure they exist)
-			unsigned int ind1 = stoi(str.substr(0,foundF))-1;
-			mesh.vertices.emplace_back();
-			mesh.vertices.back().pos = positions_temp[ind1];
-
-			//UVs (second index)
-			if(hasUV){
-				unsigned int ind2 = stoi(str.substr(foundF+1,foundL))-1;
-				mesh.vertices.back().texCoord = texcoords_temp[ind2];
-			}
-			//Normals (third index, in all cases)
-			if(hasNormals){
-				unsigned int ind3 = stoi(str.substr(foundL+1))-1;
-				mesh.vertices.back().normal = normals_temp[ind3];
+		mesh.vertices.resize(uniqueCorners.size());
+		ThreadUtilities::parallelFor(uniqueCorners.size(), threads, [&elements, &uniqueCorners, &mesh](unsigned int, size_t begin, size_t end){
+			for(size_t vid = begin; vid < end; ++vid){
+				fillVertex(elements, elements.corners[uniqueCorners[vid]], mesh.vertices[vid]);
 			}
-
-			mesh.indices.push_back(maxInd);
-			indices_used[str] = maxInd;
-			maxInd++;
-		}
-		indices_used.clear();
+		});
 	}
 
-	positions_temp.clear();
-	normals_temp.clear();
-	texcoords_temp.clear();
-	faces_temp.clear();
 	std::cout << "Mesh loaded with " << mesh.indices.size()/3 << " faces, " << mesh.vertices.size() << " vertices." << std::endl;
 	
 	
@@ -218,55 +525,190 @@ void MeshUtilities::centerAndUnitMesh(Mesh & mesh){
 
 }
 
+void MeshUtilities::computeBoundingBox(const Mesh & mesh, glm::vec3 & mini, glm::vec3 & maxi){
+	if(mesh.vertices.empty()){
+		mini = maxi = glm::vec3(0.0f);
+		return;
+	}
+	mini = maxi = mesh.vertices[0].pos;
+	for(const auto & vertex : mesh.vertices){
+		mini = glm::min(mini, vertex.pos);
+		maxi = glm::max(maxi, vertex.pos);
+	}
+}
+
 void MeshUtilities::computeTangentsAndBinormals(Mesh & mesh){
 	if(mesh.indices.size() * mesh.vertices.size() == 0){
 		// Missing data, or not the right mode (Points).
 		return;
 	}
-	// Start by filling everything with 0 (as we want to accumulate tangents and binormals coming from different faces for each vertex).
-	for(size_t pid = 0; pid < mesh.vertices.size(); ++pid){
-		mesh.vertices[pid].tangent = glm::vec3(0.0f);
-		mesh.vertices[pid].binormal = glm::vec3(0.0f);
-	}
-	// Then, compute both vectors for each face and accumulate them.
-	for(size_t fid = 0; fid < mesh.indices.size(); fid += 3){
-
-		// Get the vertices of the face.
-		glm::vec3 & v0 = mesh.vertices[mesh.indices[fid]].pos;
-		glm::vec3 & v1 = mesh.vertices[mesh.indices[fid+1]].pos;
-		glm::vec3 & v2 = mesh.vertices[mesh.indices[fid+2]].pos;
-		// Get the uvs of the face.
-		glm::vec2 & uv0 = mesh.vertices[mesh.indices[fid]].texCoord;
-		glm::vec2 & uv1 = mesh.vertices[mesh.indices[fid+1]].texCoord;
-		glm::vec2 & uv2 = mesh.vertices[mesh.indices[fid+2]].texCoord;
-
-		// Delta positions and uvs.
-		glm::vec3 deltaPosition1 = v1 - v0;
-		glm::vec3 deltaPosition2 = v2 - v0;
-		glm::vec2 deltaUv1 = uv1 - uv0;
-		glm::vec2 deltaUv2 = uv2 - uv0;
-
-		// Compute tangent and binormal for the face.
-		float det = 1.0f / (deltaUv1.x * deltaUv2.y - deltaUv1.y * deltaUv2.x);
-    	glm::vec3 tangent = det * (deltaPosition1 * deltaUv2.y   - deltaPosition2 * deltaUv1.y);
-    	glm::vec3 binormal = det * (deltaPosition2 * deltaUv1.x   - deltaPosition1 * deltaUv2.x);
-
-    	// Accumulate them. We don't normalize to get a free weighting based on the size of the face.
-    	mesh.vertices[mesh.indices[fid]].tangent += tangent;
-    	mesh.vertices[mesh.indices[fid+1]].tangent += tangent;
-    	mesh.vertices[mesh.indices[fid+2]].tangent += tangent;
-
-    	mesh.vertices[mesh.indices[fid]].binormal += binormal;
-    	mesh.vertices[mesh.indices[fid+1]].binormal += binormal;
-    	mesh.vertices[mesh.indices[fid+2]].binormal += binormal;
-	}
-	// Finally, enforce orthogonality and good orientation of the basis.
-	for(size_t tid = 0; tid < mesh.vertices.size(); ++tid){
-		mesh.vertices[tid].tangent = normalize(mesh.vertices[tid].tangent - mesh.vertices[tid].normal * dot(mesh.vertices[tid].normal, mesh.vertices[tid].tangent));
-		if(dot(cross(mesh.vertices[tid].normal, mesh.vertices[tid].tangent), mesh.vertices[tid].binormal) < 0.0f){
-			mesh.vertices[tid].tangent *= -1.0f;
- 		}
-	}
+	const size_t facesCount = mesh.indices.size() / 3;
+	const size_t verticesCount = mesh.vertices.size();
+	const unsigned int threads = ThreadUtilities::threadCount();
+	const size_t rangesCount = std::max(size_t(1), std::min(size_t(threads), facesCount / 4096));
+	
+	// The first range of faces accumulates directly in the vertices, the others in their own buffers.
+	vector<vector<glm::vec3>> accumulators(rangesCount - 1);
+	
+	ThreadUtilities::parallelFor(facesCount, (unsigned int)rangesCount, [&](unsigned int rid, size_t begin, size_t end){
+		// Frames are accumulated in the vertices for the first range, in tangent/binormal pairs for the others.
+		vector<glm::vec3> * const accumulator = rid == 0 ? nullptr : &accumulators[rid - 1];
+		if(rid == 0){
+			for(size_t vid = 0; vid < verticesCount; ++vid){
+				mesh.vertices[vid].tangent = glm::vec3(0.0f);
+				mesh.vertices[vid].binormal = glm::vec3(0.0f);
+			}
+		} else {
+			accumulator->assign(2 * verticesCount, glm::vec3(0.0f));
+		}
+		
+		// Faces are processed in blocks: gather the deltas in small arrays, then compute the frames four faces at a time.
+		const size_t blockSize = 256;
+		alignas(16) float dp1x[blockSize] = {}, dp1y[blockSize] = {}, dp1z[blockSize] = {};
+		alignas(16) float dp2x[blockSize] = {}, dp2y[blockSize] = {}, dp2z[blockSize] = {};
+		alignas(16) float du1x[blockSize] = {}, du1y[blockSize] = {}, du2x[blockSize] = {}, du2y[blockSize] = {};
+		alignas(16) float tx[blockSize], ty[blockSize], tz[blockSize];
+		alignas(16) float bx[blockSize], by[blockSize], bz[blockSize];
+		
+		for(size_t blockStart = begin; blockStart < end; blockStart += blockSize){
+			const size_t count = std::min(blockSize, end - blockStart);
+			const uint32_t * const ids = &mesh.indices[3 * blockStart];
+			for(size_t i = 0; i < count; ++i){
+				const Vertex & v0 = mesh.vertices[ids[3*i]];
+				const Vertex & v1 = mesh.vertices[ids[3*i+1]];
+				const Vertex & v2 = mesh.vertices[ids[3*i+2]];
+				// Delta positions and uvs.
+				dp1x[i] = v1.pos.x - v0.pos.x; dp1y[i] = v1.pos.y - v0.pos.y; dp1z[i] = v1.pos.z - v0.pos.z;
+				dp2x[i] = v2.pos.x - v0.pos.x; dp2y[i] = v2.pos.y - v0.pos.y; dp2z[i] = v2.pos.z - v0.pos.z;
+				du1x[i] = v1.texCoord.x - v0.texCoord.x; du1y[i] = v1.texCoord.y - v0.texCoord.y;
+				du2x[i] = v2.texCoord.x - v0.texCoord.x; du2y[i] = v2.texCoord.y - v0.texCoord.y;
+			}
+			size_t i = 0;
+#ifdef DRAGON_SSE
+			// Stale entries past the end of the last block are computed but never used.
+			for(; i < count; i += 4){
+				const __m128 e1x = _mm_load_ps(dp1x + i), e1y = _mm_load_ps(dp1y + i), e1z = _mm_load_ps(dp1z + i);
+				const __m128 e2x = _mm_load_ps(dp2x + i), e2y = _mm_load_ps(dp2y + i), e2z = _mm_load_ps(dp2z + i);
+				const __m128 u1x = _mm_load_ps(du1x + i), u1y = _mm_load_ps(du1y + i);
+				const __m128 u2x = _mm_load_ps(du2x + i), u2y = _mm_load_ps(du2y + i);
+				const __m128 det = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sub_ps(_mm_mul_ps(u1x, u2y), _mm_mul_ps(u1y, u2x)));
+				_mm_store_ps(tx + i, _mm_mul_ps(det, _mm_sub_ps(_mm_mul_ps(e1x, u2y), _mm_mul_ps(e2x, u1y))));
+				_mm_store_ps(ty + i, _mm_mul_ps(det, _mm_sub_ps(_mm_mul_ps(e1y, u2y), _mm_mul_ps(e2y, u1y))));
+				_mm_store_ps(tz + i, _mm_mul_ps(det, _mm_sub_ps(_mm_mul_ps(e1z, u2y), _mm_mul_ps(e2z, u1y))));
+				_mm_store_ps(bx + i, _mm_mul_ps(det, _mm_sub_ps(_mm_mul_ps(e2x, u1x), _mm_mul_ps(e1x, u2x))));
+				_mm_store_ps(by + i, _mm_mul_ps(det, _mm_sub_ps(_mm_mul_ps(e2y, u1x), _mm_mul_ps(e1y, u2x))));
+				_mm_store_ps(bz + i, _mm_mul_ps(det, _mm_sub_ps(_mm_mul_ps(e2z, u1x), _mm_mul_ps(e1z, u2x))));
+			}
+#endif
+			for(; i < count; ++i){
+				// Compute tangent and binormal for the face.
+				const float det = 1.0f / (du1x[i] * du2y[i] - du1y[i] * du2x[i]);
+				tx[i] = det * (dp1x[i] * du2y[i] - dp2x[i] * du1y[i]);
+				ty[i] = det * (dp1y[i] * du2y[i] - dp2y[i] * du1y[i]);
+				tz[i] = det * (dp1z[i] * du2y[i] - dp2z[i] * du1y[i]);
+				bx[i] = det * (dp2x[i] * du1x[i] - dp1x[i] * du2x[i]);
+				by[i] = det * (dp2y[i] * du1x[i] - dp1y[i] * du2x[i]);
+				bz[i] = det * (dp2z[i] * du1x[i] - dp1z[i] * du2x[i]);
+			}
+			// Accumulate them. We don't normalize to get a free weighting based on the size of the face.
+			for(size_t fid = 0; fid < count; ++fid){
+				const glm::vec3 tangent(tx[fid], ty[fid], tz[fid]);
+				const glm::vec3 binormal(bx[fid], by[fid], bz[fid]);
+				for(size_t cid = 3 * fid; cid < 3 * fid + 3; ++cid){
+					if(accumulator){
+						(*accumulator)[2 * ids[cid]] += tangent;
+						(*accumulator)[2 * ids[cid] + 1] += binormal;
+					} else {
+						mesh.vertices[ids[cid]].tangent += tangent;
+						mesh.vertices[ids[cid]].binormal += binormal;
+					}
+				}
+			}
+		}
+	});
+	
+	// Then, for each vertex, sum the contributions of all ranges and enforce orthogonality and good orientation of the basis.
+	ThreadUtilities::parallelFor(verticesCount, threads, [&](unsigned int, size_t begin, size_t end){
+		for(size_t tid = begin; tid < end; ++tid){
+			Vertex & vertex = mesh.vertices[tid];
+			for(const vector<glm::vec3> & accumulator : accumulators){
+				vertex.tangent += accumulator[2 * tid];
+				vertex.binormal += accumulator[2 * tid + 1];
+			}
+			vertex.tangent = normalize(vertex.tangent - vertex.normal * dot(vertex.normal, vertex.tangent));
+			if(dot(cross(vertex.normal, vertex.tangent), vertex.binormal) < 0.0f){
+				vertex.tangent *= -1.0f;
+			}
+		}
+	});
 	std::cout << "Mesh: " << mesh.vertices.size() << " tangents and binormals computed." << std::endl;
 }
 
+// Octahedral encoding of a direction in [-1,1]^2.
+static glm::vec2 encodeOctahedral(const glm::vec3 & dir){
+	const float norm = std::abs(dir.x) + std::abs(dir.y) + std::abs(dir.z);
+	if(norm == 0.0f){
+		return glm::vec2(0.0f);
+	}
+	const glm::vec3 v = dir / norm;
+	if(v.z >= 0.0f){
+		return glm::vec2(v.x, v.y);
+	}
+	// Fold the lower hemisphere over the diagonals.
+	const glm::vec2 signs(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+	return (1.0f - glm::abs(glm::vec2(v.y, v.x))) * signs;
+}
+
+static inline int16_t packSnorm16(const float value){
+	return int16_t(std::round(glm::clamp(value, -1.0f, 1.0f) * 32767.0f));
+}
+
+void MeshUtilities::compressVertices(const Vertex * vertices, const size_t count, std::vector<CompactVertex> & compactVertices){
+	compactVertices.resize(count);
+	for(size_t vid = 0; vid < count; ++vid){
+		const Vertex & vertex = vertices[vid];
+		CompactVertex & compact = compactVertices[vid];
+		// The binormal is rebuilt from the normal and tangent, only its orientation is kept.
+		const float handedness = glm::dot(glm::cross(vertex.normal, vertex.tangent), vertex.binormal) < 0.0f ? -1.0f : 1.0f;
+		compact.pos = glm::i16vec4(packSnorm16(vertex.pos.x), packSnorm16(vertex.pos.y), packSnorm16(vertex.pos.z), packSnorm16(handedness));
+		const glm::vec2 normal = encodeOctahedral(vertex.normal);
+		compact.normal = glm::i16vec2(packSnorm16(normal.x), packSnorm16(normal.y));
+		const glm::vec2 tangent = encodeOctahedral(vertex.tangent);
+		compact.tangent = glm::i16vec2(packSnorm16(tangent.x), packSnorm16(tangent.y));
+		compact.texCoord = glm::u16vec2(glm::packHalf1x16(vertex.texCoord.x), glm::packHalf1x16(vertex.texCoord.y));
+	}
+}
+
+size_t MeshUtilities::vertexSize(const VertexFormat format){
+	return format == MeshUtilities::Compact ? sizeof(CompactVertex) : sizeof(Vertex);
+}
+
+VertexLayout MeshUtilities::vertexLayout(const VertexFormat format){
+	VertexLayout layout;
+	if(format == MeshUtilities::Compact){
+		const auto attributes = CompactVertex::getAttributeDescriptions();
+		layout.bindings = { CompactVertex::getBindingDescription() };
+		layout.attributes.assign(attributes.begin(), attributes.end());
+	} else {
+		const auto attributes = Vertex::getAttributeDescriptions();
+		layout.bindings = { Vertex::getBindingDescription() };
+		layout.attributes.assign(attributes.begin(), attributes.end());
+	}
+	return layout;
+}
+
+VertexLayout MeshUtilities::positionLayout(const VertexFormat format){
+	VertexLayout layout;
+	VkVertexInputBindingDescription binding = {};
+	binding.binding = 0;
+	binding.stride = format == MeshUtilities::Compact ? sizeof(glm::i16vec4) : sizeof(glm::vec3);
+	binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	VkVertexInputAttributeDescription attribute = {};
+	attribute.binding = 0;
+	attribute.location = 0;
+	attribute.format = format == MeshUtilities::Compact ? VK_FORMAT_R16G16B16A16_SNORM : VK_FORMAT_R32G32B32_SFLOAT;
+	attribute.offset = 0;
+	layout.bindings = { binding };
+	layout.attributes = { attribute };
+	return layout;
+}
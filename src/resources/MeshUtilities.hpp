@@ -2,8 +2,15 @@
 #define MeshUtilities_h
 
 #include "../common.hpp"
+#include <glm/gtc/type_precision.hpp>
 #include <array>
 
+/// Vertex buffers bindings and attributes read by a pipeline.
+struct VertexLayout {
+	std::vector<VkVertexInputBindingDescription> bindings;
+	std::vector<VkVertexInputAttributeDescription> attributes;
+};
+
 struct Vertex {
 	glm::vec3 pos;
 	glm::vec3 normal;
@@ -53,11 +60,69 @@ struct Vertex {
 	
 };
 
+// Vertices are uploaded and cached as is, and their attributes gathered as floats: keep them tightly packed.
+static_assert(sizeof(Vertex) == 14 * sizeof(float), "Unexpected Vertex size.");
+static_assert(offsetof(Vertex, pos) == 0 && offsetof(Vertex, normal) == 3 * sizeof(float) && offsetof(Vertex, tangent) == 6 * sizeof(float)
+	&& offsetof(Vertex, binormal) == 9 * sizeof(float) && offsetof(Vertex, texCoord) == 12 * sizeof(float), "Unexpected Vertex layout.");
+
+// Quantized vertex (20 bytes), positions are expected in [-1,1].
+struct CompactVertex {
+	glm::i16vec4 pos; // Snorm position, w: handedness of the tangent frame.
+	glm::i16vec2 normal; // Snorm octahedral normal.
+	glm::i16vec2 tangent; // Snorm octahedral tangent.
+	glm::u16vec2 texCoord; // Half float UV.
+	
+	// Binding location, rate of input.
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(CompactVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return bindingDescription;
+	}
+	
+	// Attribute layout, the binormal (location 3) is reconstructed in the shader.
+	static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions = {};
+		// Position and handedness
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_SNORM;
+		attributeDescriptions[0].offset = offsetof(CompactVertex, pos);
+		// Normal
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescriptions[1].offset = offsetof(CompactVertex, normal);
+		// Tangent
+		attributeDescriptions[2].binding = 0;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = VK_FORMAT_R16G16_SNORM;
+		attributeDescriptions[2].offset = offsetof(CompactVertex, tangent);
+		// UV
+		attributeDescriptions[3].binding = 0;
+		attributeDescriptions[3].location = 4;
+		attributeDescriptions[3].format = VK_FORMAT_R16G16_SFLOAT;
+		attributeDescriptions[3].offset = offsetof(CompactVertex, texCoord);
+		return attributeDescriptions;
+	}
+};
+
 typedef struct {
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
 } Mesh;
 
+/// Cluster of triangles contiguous in the index buffer, with bounds for culling.
+struct Meshlet {
+	glm::vec3 center; ///< Bounding sphere.
+	float radius;
+	glm::vec3 coneAxis; ///< Normal cone: all triangles face away from viewers in the cone of this axis and cutoff.
+	float coneCutoff; ///< Sine of the cone half angle, 1 if the meshlet can't be culled.
+	uint32_t firstIndex;
+	uint32_t indicesCount;
+};
+
 
 
 class MeshUtilities {
@@ -70,16 +135,36 @@ public:
 	enum LoadMode {
 		Expanded, Points, Indexed
 	};
+	
+	// Vertex formats used on the GPU: full floats (Vertex) or quantized (CompactVertex).
+	enum VertexFormat {
+		Standard, Compact
+	};
 
 	/// Load an obj file from disk into the mesh structure.
 	static void loadObj(const std::string & path, Mesh & mesh, LoadMode mode);
 
 	/// Center the mesh and scale it to fit in the [-1,1] box.
 	static void centerAndUnitMesh(Mesh & mesh);
+	
+	/// Compute the axis-aligned bounding box of the mesh vertices.
+	static void computeBoundingBox(const Mesh & mesh, glm::vec3 & mini, glm::vec3 & maxi);
 
-	/// Compute the tangents and binormal vectors for each vertex.
+	/// Compute the tangents and binormal vectors for each vertex, on ThreadUtilities::threadCount() threads.
 	static void computeTangentsAndBinormals(Mesh & mesh);
 	
+	/// Quantize vertices to the compact format, positions have to be in [-1,1].
+	static void compressVertices(const Vertex * vertices, const size_t count, std::vector<CompactVertex> & compactVertices);
+	
+	/// Size in bytes of a vertex in the given format.
+	static size_t vertexSize(const VertexFormat format);
+	
+	/// Bindings and attributes of the vertex buffer in the given format.
+	static VertexLayout vertexLayout(const VertexFormat format);
+	
+	/// Bindings and attributes of the position-only stream in the given format (vec3 or snorm16 vec4).
+	static VertexLayout positionLayout(const VertexFormat format);
+	
 };
 
 #endif 
@@ -1,16 +1,132 @@
 #include "Resources.hpp"
 
 #include <algorithm>
+#include <climits>
 #include <ios>
 #include <fstream>
 #include <sstream>
 
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #ifdef _WIN32
 #define STBI_MSC_SECURE_CRT
 #endif
 
+/// Cursor over a mapped file, for images too big for stbi_load_from_memory.
+struct MappedReader {
+	const stbi_uc * begin;
+	const stbi_uc * current;
+	const stbi_uc * end;
+};
+
+static int mappedRead(void * user, char * data, int size){
+	MappedReader * reader = static_cast<MappedReader *>(user);
+	const size_t count = std::min(size_t(size), size_t(reader->end - reader->current));
+	memcpy(data, reader->current, count);
+	reader->current += count;
+	return int(count);
+}
+
+static void mappedSkip(void * user, int n){
+	MappedReader * reader = static_cast<MappedReader *>(user);
+	const ptrdiff_t offset = std::max(ptrdiff_t(n), reader->begin - reader->current);
+	reader->current += std::min(offset, reader->end - reader->current);
+}
+
+static int mappedEof(void * user){
+	const MappedReader * reader = static_cast<const MappedReader *>(user);
+	return reader->current >= reader->end;
+}
+
+static const stbi_io_callbacks mappedCallbacks = { mappedRead, mappedSkip, mappedEof };
+
+MappedFile::MappedFile(const std::string & path, const Access access){
+#ifdef _WIN32
+	const DWORD hint = access == Sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, hint, NULL);
+	if(file == INVALID_HANDLE_VALUE){
+		std::cerr << "Unable to map file at path \"" << path << "\"." << std::endl;
+		return;
+	}
+	LARGE_INTEGER fileSize;
+	if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0){
+		CloseHandle(file);
+		return;
+	}
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(mapping == NULL){
+		std::cerr << "Unable to map file at path \"" << path << "\"." << std::endl;
+		CloseHandle(file);
+		return;
+	}
+	const void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(view == NULL){
+		std::cerr << "Unable to map file at path \"" << path << "\"." << std::endl;
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return;
+	}
+	_file = file;
+	_mapping = mapping;
+	_data = static_cast<const char *>(view);
+	_size = size_t(fileSize.QuadPart);
+#else
+	const int file = open(path.c_str(), O_RDONLY);
+	if(file < 0){
+		std::cerr << "Unable to map file at path \"" << path << "\"." << std::endl;
+		return;
+	}
+	struct stat infos;
+	if(fstat(file, &infos) != 0 || infos.st_size == 0){
+		close(file);
+		return;
+	}
+	void * view = mmap(NULL, size_t(infos.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	// The mapping stays valid once the descriptor is closed.
+	close(file);
+	if(view == MAP_FAILED){
+		std::cerr << "Unable to map file at path \"" << path << "\"." << std::endl;
+		return;
+	}
+	// Sequential reads benefit from aggressive read-ahead, random ones only fault the pages touched.
+	if(access == Sequential){
+		madvise(view, size_t(infos.st_size), MADV_SEQUENTIAL);
+		madvise(view, size_t(infos.st_size), MADV_WILLNEED);
+	} else {
+		madvise(view, size_t(infos.st_size), MADV_RANDOM);
+	}
+	_data = static_cast<const char *>(view);
+	_size = size_t(infos.st_size);
+#endif
+}
+
+MappedFile::~MappedFile(){
+#ifdef _WIN32
+	if(_data){
+		UnmapViewOfFile(_data);
+	}
+	if(_mapping){
+		CloseHandle(_mapping);
+	}
+	if(_file){
+		CloseHandle(_file);
+	}
+#else
+	if(_data){
+		munmap(const_cast<char *>(_data), _size);
+	}
+#endif
+}
+
 char * Resources::loadRawDataFromExternalFile(const std::string & path, size_t & size) {
 	char * rawContent;
 	std::ifstream inputFile(path, std::ios::binary|std::ios::ate);
@@ -19,7 +135,7 @@ char * Resources::loadRawDataFromExternalFile(const std::string & path, size_t &
 		return NULL;
 	}
 	std::ifstream::pos_type fileSize = inputFile.tellg();
-	rawContent = new char[fileSize];
+	rawContent = (char*)malloc(size_t(fileSize));
 	inputFile.seekg(0, std::ios::beg);
 	inputFile.read(&rawContent[0], fileSize);
 	inputFile.close();
@@ -28,40 +144,65 @@ char * Resources::loadRawDataFromExternalFile(const std::string & path, size_t &
 }
 
 std::string Resources::loadStringFromExternalFile(const std::string & filename) {
-	std::ifstream in;
-	// Open a stream to the file.
-	in.open(filename.c_str());
-	if (!in) {
+	const MappedFile file(filename);
+	if (!file.valid()) {
 		std::cerr << "" << filename + " is not a valid file." << std::endl;
 		return "";
 	}
-	std::stringstream buffer;
-	// Read the stream in a buffer.
-	buffer << in.rdbuf();
-	// Create a string based on the content of the buffer.
-	std::string line = buffer.str();
-	in.close();
-	return line;
+	// Create a string based on the content of the mapping.
+	return std::string(file.data(), file.size());
+}
+
+bool Resources::fileInfos(const std::string & path, uint64_t & size, uint64_t & modificationTime){
+#ifdef _WIN32
+	struct _stat64 infos;
+	if(_stat64(path.c_str(), &infos) != 0){
+		return false;
+	}
+#else
+	struct stat infos;
+	if(stat(path.c_str(), &infos) != 0){
+		return false;
+	}
+#endif
+	size = uint64_t(infos.st_size);
+	modificationTime = uint64_t(infos.st_mtime);
+	return true;
+}
+
+uint64_t Resources::hashBytes(const void * data, size_t size, uint64_t hash){
+	const unsigned char * bytes = static_cast<const unsigned char *>(data);
+	for(size_t i = 0; i < size; ++i){
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+uint64_t Resources::hashFile(const std::string & path){
+	const MappedFile file(path);
+	return file.valid() ? hashBytes(file.data(), file.size()) : 0;
 }
 
 int Resources::loadImage(const std::string & path, unsigned int & width, unsigned int & height, unsigned int & channels, void **data, const bool flip){
 	
-	size_t rawSize = 0;
-	unsigned char * rawData;
-	rawData = (unsigned char*)(Resources::loadRawDataFromExternalFile(path, rawSize));
-	
-	if(rawData == NULL || rawSize == 0){
+	// Decode straight from the mapped file.
+	const MappedFile file(path);
+	if(!file.valid()){
 		return 1;
 	}
 	
-	stbi_set_flip_vertically_on_load(flip);
 	// Force 4 channels.
 	channels = 4;
 	int localWidth = 0;
 	int localHeight = 0;
-	// Beware: the size has to be cast to int, imposing a limit on big file sizes.
-	*data = stbi_load_from_memory(rawData, (int)rawSize, &localWidth, &localHeight, NULL, channels);
-	free(rawData);
+	const stbi_uc * rawData = reinterpret_cast<const stbi_uc *>(file.data());
+	if(file.size() <= size_t(INT_MAX)){
+		*data = stbi_load_from_memory(rawData, (int)file.size(), &localWidth, &localHeight, NULL, channels);
+	} else {
+		// The memory loader takes an int size, stream bigger files through callbacks.
+		MappedReader reader = { rawData, rawData, rawData + file.size() };
+		*data = stbi_load_from_callbacks(&mappedCallbacks, &reader, &localWidth, &localHeight, NULL, channels);
+	}
 	
 	if(*data == NULL){
 		return 1;
@@ -70,7 +211,37 @@ int Resources::loadImage(const std::string & path, unsigned int & width, unsigne
 	width = (unsigned int)localWidth;
 	height = (unsigned int)localHeight;
 	
+	// The stb_image flip setting is global, flip here so that images can be decoded on multiple threads.
+	if(flip){
+		const size_t rowSize = size_t(width) * channels;
+		std::vector<unsigned char> row(rowSize);
+		unsigned char * pixels = static_cast<unsigned char *>(*data);
+		for(size_t y = 0; y < height / 2; ++y){
+			unsigned char * top = pixels + y * rowSize;
+			unsigned char * bottom = pixels + (height - 1 - y) * rowSize;
+			memcpy(row.data(), top, rowSize);
+			memcpy(top, bottom, rowSize);
+			memcpy(bottom, row.data(), rowSize);
+		}
+	}
+	
 	return 0;
 }
 
+int Resources::imageInfos(const std::string & path, unsigned int & width, unsigned int & height){
+	// Only the pages of the header are read from the mapping.
+	const MappedFile file(path, MappedFile::Random);
+	if(!file.valid()){
+		return 1;
+	}
+	int localWidth = 0;
+	int localHeight = 0;
+	int localChannels = 0;
+	if(stbi_info_from_memory(reinterpret_cast<const stbi_uc *>(file.data()), (int)std::min(file.size(), size_t(INT_MAX)), &localWidth, &localHeight, &localChannels) == 0){
+		return 1;
+	}
+	width = (unsigned int)localWidth;
+	height = (unsigned int)localHeight;
+	return 0;
+}
 
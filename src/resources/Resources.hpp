@@ -4,18 +4,61 @@
 
 #include "../common.hpp"
 
+/// Read-only view of a file mapped in memory, unmapped when the object is destroyed.
+class MappedFile {
+	
+public:
+	
+	/// Expected access pattern, forwarded to the system to tune read-ahead.
+	enum Access {
+		Sequential, Random
+	};
+	
+	MappedFile(const std::string & path, const Access access = Sequential);
+	
+	~MappedFile();
+	
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+	
+	bool valid() const { return _data != nullptr; }
+	const char * data() const { return _data; }
+	size_t size() const { return _size; }
+	
+private:
+	
+	const char * _data = nullptr;
+	size_t _size = 0;
+#ifdef _WIN32
+	void * _file = nullptr;
+	void * _mapping = nullptr;
+#endif
+};
 
 class Resources {
 
 	
 public:
 	
+	/// Read a whole file in a buffer allocated with malloc, to release with free.
 	static char * loadRawDataFromExternalFile(const std::string & path, size_t & size);
 	
 	static std::string loadStringFromExternalFile(const std::string & filename);
 	
+	/// Query the size and last modification time of a file, return false if it doesn't exist.
+	static bool fileInfos(const std::string & path, uint64_t & size, uint64_t & modificationTime);
+	
+	/// FNV-1a 64 bits hash of bytes, can be chained by passing the previous hash.
+	static uint64_t hashBytes(const void * data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL);
+	
+	/// Hash of the content of a file, 0 if it doesn't exist.
+	static uint64_t hashFile(const std::string & path);
+	
 	static int loadImage(const std::string & path, unsigned int & width, unsigned int & height, unsigned int & channels, void **data, const bool flip);
 	
+	/// Read the dimensions of an image from its header, without decoding it.
+	static int imageInfos(const std::string & path, unsigned int & width, unsigned int & height);
+	
 };
 
 
@@ -0,0 +1,293 @@
+#include "TextureCache.hpp"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+
+/// KTX2 file layout: header, levels index, data format descriptor, key/value data, then the levels from the smallest one.
+struct KtxHeader {
+	uint8_t identifier[12];
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	uint64_t sgdByteOffset;
+	uint64_t sgdByteLength;
+};
+
+struct KtxLevel {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+/// Value of our key in the key/value data, to detect outdated files.
+struct SourceInfos {
+	uint64_t sourceSize;
+	uint64_t sourceTime;
+	uint64_t sourceHash;
+	uint32_t version;
+	uint32_t encoding;
+	uint32_t normal;
+};
+
+static const uint8_t ktxIdentifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const char sourceKey[] = "dvSource";
+
+static void appendBytes(std::vector<char> & buffer, const void * data, size_t size){
+	const char * bytes = static_cast<const char *>(data);
+	buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+static void appendWord(std::vector<char> & buffer, const uint32_t word){
+	appendBytes(buffer, &word, sizeof(uint32_t));
+}
+
+// Basic data format descriptor of a RGBA8, BC1 RGB or BC5 texture, in linear space.
+static std::vector<char> dataFormatDescriptor(const TextureUtilities::Encoding encoding){
+	if(encoding == TextureUtilities::RGBA8){
+		std::vector<char> dfd;
+		appendWord(dfd, 4 + 24 + 16 * 4);
+		appendWord(dfd, 0);
+		appendWord(dfd, 2 | ((24 + 16 * 4) << 16));
+		// Color model KHR_DF_MODEL_RGBSDA, BT709 primaries, linear transfer.
+		appendWord(dfd, 1 | (1 << 8) | (1 << 16));
+		appendWord(dfd, 0); // Single texel blocks.
+		appendWord(dfd, 4);
+		appendWord(dfd, 0);
+		// One 8 bits sample per channel, alpha having the channel id 15.
+		const uint32_t channels[4] = { 0, 1, 2, 15 };
+		for(uint32_t sid = 0; sid < 4; ++sid){
+			appendWord(dfd, (8 * sid) | (7 << 16) | (channels[sid] << 24));
+			appendWord(dfd, 0);
+			appendWord(dfd, 0);
+			appendWord(dfd, 255);
+		}
+		return dfd;
+	}
+	const uint32_t samplesCount = encoding == TextureUtilities::BC1 ? 1 : 2;
+	const uint32_t blockSize = 24 + 16 * samplesCount;
+	// Color models KHR_DF_MODEL_BC1A and KHR_DF_MODEL_BC5, BT709 primaries, linear transfer.
+	const uint32_t colorModel = encoding == TextureUtilities::BC1 ? 128 : 132;
+	std::vector<char> dfd;
+	appendWord(dfd, 4 + blockSize);
+	appendWord(dfd, 0); // Khronos vendor, basic descriptor.
+	appendWord(dfd, 2 | (blockSize << 16)); // Version 1.3.
+	appendWord(dfd, colorModel | (1 << 8) | (1 << 16));
+	appendWord(dfd, 3 | (3 << 8)); // 4x4 texels blocks.
+	appendWord(dfd, encoding == TextureUtilities::BC1 ? 8 : 16);
+	appendWord(dfd, 0);
+	// One 64 bits sample per channel: BC1 color, or BC5 red then green.
+	for(uint32_t sid = 0; sid < samplesCount; ++sid){
+		appendWord(dfd, (64 * sid) | (63 << 16) | (sid << 24));
+		appendWord(dfd, 0);
+		appendWord(dfd, 0);
+		appendWord(dfd, 0xFFFFFFFF);
+	}
+	return dfd;
+}
+
+// Key/value entry, padded to 4 bytes. Keys have to be written in increasing order.
+static void appendKeyValue(std::vector<char> & kvd, const std::string & key, const void * value, const size_t size){
+	appendWord(kvd, uint32_t(key.size() + 1 + size));
+	appendBytes(kvd, key.c_str(), key.size() + 1);
+	appendBytes(kvd, value, size);
+	kvd.resize((kvd.size() + 3) & ~size_t(3), 0);
+}
+
+VkFormat TextureCache::vulkanFormat(const TextureUtilities::Encoding encoding){
+	switch(encoding){
+		case TextureUtilities::BC1:
+			return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case TextureUtilities::BC5:
+			return VK_FORMAT_BC5_UNORM_BLOCK;
+		default:
+			return VK_FORMAT_R8G8B8A8_UNORM;
+	}
+}
+
+TextureCache::TextureCache(const std::string & pngPath, const TextureUtilities::Encoding encoding, const bool normal){
+	const std::string ktxPath = pngPath.substr(0, pngPath.find_last_of('.')) + ".ktx2";
+	if(!map(ktxPath, pngPath, encoding, normal)){
+		build(ktxPath, pngPath, encoding, normal);
+	}
+}
+
+bool TextureCache::map(const std::string & ktxPath, const std::string & pngPath, const TextureUtilities::Encoding encoding, const bool normal){
+	uint64_t sourceSize = 0;
+	uint64_t sourceTime = 0;
+	uint64_t ktxSize = 0;
+	uint64_t ktxTime = 0;
+	if(!Resources::fileInfos(pngPath, sourceSize, sourceTime) || !Resources::fileInfos(ktxPath, ktxSize, ktxTime)){
+		return false;
+	}
+	std::unique_ptr<MappedFile> file(new MappedFile(ktxPath));
+	if(!file->valid() || file->size() < sizeof(KtxHeader)){
+		return false;
+	}
+	KtxHeader header;
+	memcpy(&header, file->data(), sizeof(KtxHeader));
+	if(memcmp(header.identifier, ktxIdentifier, sizeof(ktxIdentifier)) != 0 || header.vkFormat != uint32_t(vulkanFormat(encoding)) || header.levelCount == 0 || header.faceCount != 1 || header.layerCount != 0 || header.supercompressionScheme != 0){
+		return false;
+	}
+	if(sizeof(KtxHeader) + sizeof(KtxLevel) * size_t(header.levelCount) > file->size() || size_t(header.kvdByteOffset) + header.kvdByteLength > file->size()){
+		return false;
+	}
+	// Find our source infos in the key/value data.
+	SourceInfos infos;
+	bool found = false;
+	size_t offset = header.kvdByteOffset;
+	const size_t kvdEnd = size_t(header.kvdByteOffset) + header.kvdByteLength;
+	while(offset + sizeof(uint32_t) <= kvdEnd){
+		uint32_t length;
+		memcpy(&length, file->data() + offset, sizeof(uint32_t));
+		offset += sizeof(uint32_t);
+		if(offset + length > kvdEnd){
+			break;
+		}
+		const std::string key(file->data() + offset, strnlen(file->data() + offset, length));
+		if(key == sourceKey && length == sizeof(sourceKey) + sizeof(SourceInfos)){
+			memcpy(&infos, file->data() + offset + sizeof(sourceKey), sizeof(SourceInfos));
+			found = true;
+			break;
+		}
+		offset = (offset + length + 3) & ~size_t(3);
+	}
+	if(!found || infos.version != version || infos.encoding != uint32_t(encoding) || infos.normal != uint32_t(normal) || infos.sourceSize != sourceSize){
+		return false;
+	}
+	// A different modification time doesn't always mean different content (checkout, copy), compare hashes.
+	if(infos.sourceTime != sourceTime && infos.sourceHash != Resources::hashFile(pngPath)){
+		return false;
+	}
+
+	std::vector<Level> levels(header.levelCount);
+	for(uint32_t lid = 0; lid < header.levelCount; ++lid){
+		KtxLevel level;
+		memcpy(&level, file->data() + sizeof(KtxHeader) + sizeof(KtxLevel) * lid, sizeof(KtxLevel));
+		const uint32_t levelWidth = std::max(1u, header.pixelWidth >> lid);
+		const uint32_t levelHeight = std::max(1u, header.pixelHeight >> lid);
+		if(level.byteLength != TextureUtilities::encodedSize(levelWidth, levelHeight, encoding) || level.byteOffset + level.byteLength > file->size()){
+			return false;
+		}
+		levels[lid] = { level.byteOffset, level.byteLength };
+	}
+
+	_format = VkFormat(header.vkFormat);
+	_width = header.pixelWidth;
+	_height = header.pixelHeight;
+	_levels = levels;
+	_data = file->data();
+	_file = std::move(file);
+	std::cout << "Texture loaded from cache with " << _width << "x" << _height << " pixels, " << _levels.size() << " levels." << std::endl;
+	return true;
+}
+
+void TextureCache::build(const std::string & ktxPath, const std::string & pngPath, const TextureUtilities::Encoding encoding, const bool normal){
+	unsigned int width, height, channels;
+	void * image;
+	if(Resources::loadImage(pngPath, width, height, channels, &image, true) != 0){
+		std::cerr << "Unable to load texture at path \"" << pngPath << "\"." << std::endl;
+		return;
+	}
+
+	// Full mip chain, then encoded level by level.
+	std::vector<std::vector<unsigned char>> pixels;
+	TextureUtilities::generateMipmaps(static_cast<unsigned char *>(image), width, height, normal, pixels);
+	free(image);
+	const uint32_t levelsCount = uint32_t(pixels.size());
+	std::vector<std::vector<unsigned char>> levels(levelsCount);
+	for(uint32_t lid = 0; lid < levelsCount; ++lid){
+		const uint32_t levelWidth = std::max(1u, width >> lid);
+		const uint32_t levelHeight = std::max(1u, height >> lid);
+		levels[lid].resize(TextureUtilities::encodedSize(levelWidth, levelHeight, encoding));
+		TextureUtilities::encode(pixels[lid].data(), levelWidth, levelHeight, encoding, levels[lid].data());
+		std::vector<unsigned char>().swap(pixels[lid]);
+	}
+
+	// Descriptor and key/value data.
+	const std::vector<char> dfd = dataFormatDescriptor(encoding);
+	SourceInfos infos;
+	memset(&infos, 0, sizeof(SourceInfos));
+	Resources::fileInfos(pngPath, infos.sourceSize, infos.sourceTime);
+	infos.sourceHash = Resources::hashFile(pngPath);
+	infos.version = version;
+	infos.encoding = uint32_t(encoding);
+	infos.normal = uint32_t(normal);
+	std::vector<char> kvd;
+	// Images are flipped on load, their origin is in the bottom left corner.
+	appendKeyValue(kvd, "KTXorientation", "ru", 3);
+	appendKeyValue(kvd, "KTXwriter", "DragonVulkan", 13);
+	appendKeyValue(kvd, sourceKey, &infos, sizeof(SourceInfos));
+
+	KtxHeader header;
+	memset(&header, 0, sizeof(KtxHeader));
+	memcpy(header.identifier, ktxIdentifier, sizeof(ktxIdentifier));
+	header.vkFormat = uint32_t(vulkanFormat(encoding));
+	header.typeSize = 1;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.faceCount = 1;
+	header.levelCount = levelsCount;
+	header.dfdByteOffset = uint32_t(sizeof(KtxHeader) + sizeof(KtxLevel) * levelsCount);
+	header.dfdByteLength = uint32_t(dfd.size());
+	header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+	header.kvdByteLength = uint32_t(kvd.size());
+
+	// Levels are stored from the smallest, each aligned on a block (and on 4 bytes for uncompressed data).
+	const size_t blockSize = encoding == TextureUtilities::RGBA8 ? 4 : (encoding == TextureUtilities::BC1 ? 8 : 16);
+	size_t offset = size_t(header.kvdByteOffset) + header.kvdByteLength;
+	std::vector<KtxLevel> index(levelsCount);
+	for(uint32_t lid = levelsCount; lid-- > 0;){
+		offset = (offset + blockSize - 1) / blockSize * blockSize;
+		index[lid] = { offset, levels[lid].size(), levels[lid].size() };
+		offset += levels[lid].size();
+	}
+	_content.resize(offset, 0);
+	memcpy(&_content[0], &header, sizeof(KtxHeader));
+	memcpy(&_content[sizeof(KtxHeader)], index.data(), sizeof(KtxLevel) * levelsCount);
+	memcpy(&_content[header.dfdByteOffset], dfd.data(), dfd.size());
+	memcpy(&_content[header.kvdByteOffset], kvd.data(), kvd.size());
+	_levels.resize(levelsCount);
+	for(uint32_t lid = 0; lid < levelsCount; ++lid){
+		memcpy(&_content[size_t(index[lid].byteOffset)], levels[lid].data(), levels[lid].size());
+		_levels[lid] = { index[lid].byteOffset, index[lid].byteLength };
+	}
+	_format = vulkanFormat(encoding);
+	_width = width;
+	_height = height;
+	_data = _content.data();
+	std::cout << "Texture: " << width << "x" << height << " cooked with " << levelsCount << " levels in " << _content.size() / 1024 << "KB." << std::endl;
+
+	// Write to a temporary file first so that a concurrent reader never maps a partial file.
+	// A file left by an interrupted cooking is discarded.
+	const std::string tempPath = ktxPath + ".tmp";
+	std::remove(tempPath.c_str());
+	std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+	if(!out){
+		std::cerr << "Unable to write texture cache at path \"" << ktxPath << "\"." << std::endl;
+		return;
+	}
+	out.write(_content.data(), _content.size());
+	out.close();
+	if(!out){
+		std::cerr << "Unable to write texture cache at path \"" << ktxPath << "\"." << std::endl;
+		std::remove(tempPath.c_str());
+		return;
+	}
+	// Windows doesn't replace existing files when renaming.
+	std::remove(ktxPath.c_str());
+	if(std::rename(tempPath.c_str(), ktxPath.c_str()) != 0){
+		std::cerr << "Unable to write texture cache at path \"" << ktxPath << "\"." << std::endl;
+		std::remove(tempPath.c_str());
+	}
+}
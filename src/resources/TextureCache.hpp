@@ -0,0 +1,59 @@
+#ifndef TextureCache_h
+#define TextureCache_h
+
+#include "../common.hpp"
+#include "TextureUtilities.hpp"
+#include "Resources.hpp"
+#include <memory>
+
+/// Texture with its full mip chain, read from a KTX2 file stored next to the source PNG.
+/// The file is cooked from the PNG when missing, or when the source or the encoding changed.
+class TextureCache {
+
+public:
+
+	/// Bump when the cooking applied to the PNG changes.
+	static const uint32_t version = 2;
+
+	/// Location of a mip level in data().
+	struct Level {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	/// Map the KTX2 file of a PNG, cooking it first if needed. Normal maps are filtered as vectors.
+	TextureCache(const std::string & pngPath, const TextureUtilities::Encoding encoding, const bool normal);
+
+	TextureCache(const TextureCache &) = delete;
+	TextureCache & operator=(const TextureCache &) = delete;
+
+	bool valid() const { return _data != nullptr; }
+
+	VkFormat format() const { return _format; }
+	uint32_t width() const { return _width; }
+	uint32_t height() const { return _height; }
+	uint32_t levelsCount() const { return uint32_t(_levels.size()); }
+	const Level & level(uint32_t i) const { return _levels[i]; }
+	const char * data() const { return _data; }
+
+	/// Vulkan format storing the encoding.
+	static VkFormat vulkanFormat(const TextureUtilities::Encoding encoding);
+
+private:
+
+	/// Map the KTX2 file and check it against the source, return false if it is missing or outdated.
+	bool map(const std::string & ktxPath, const std::string & pngPath, const TextureUtilities::Encoding encoding, const bool normal);
+
+	/// Decode the PNG, generate and encode its mip chain and write the KTX2 file. The content is kept in memory.
+	void build(const std::string & ktxPath, const std::string & pngPath, const TextureUtilities::Encoding encoding, const bool normal);
+
+	VkFormat _format = VK_FORMAT_UNDEFINED;
+	uint32_t _width = 0;
+	uint32_t _height = 0;
+	std::vector<Level> _levels;
+	const char * _data = nullptr;
+	std::unique_ptr<MappedFile> _file;
+	std::vector<char> _content;
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include "TextureUtilities.hpp"
+#include "../ThreadUtilities.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <cmath>
+
+using namespace std;
+
+uint32_t TextureUtilities::levelsCount(const uint32_t width, const uint32_t height){
+	uint32_t count = 1;
+	while((max(width, height) >> count) > 0){
+		++count;
+	}
+	return count;
+}
+
+// sRGB transfer functions, colors are stored encoded but averaged in linear space.
+static float srgbToLinear(const unsigned char value){
+	static const std::vector<float> table = [](){
+		std::vector<float> values(256);
+		for(int i = 0; i < 256; ++i){
+			const float x = float(i) / 255.0f;
+			values[i] = x <= 0.04045f ? x / 12.92f : std::pow((x + 0.055f) / 1.055f, 2.4f);
+		}
+		return values;
+	}();
+	return table[value];
+}
+
+static float linearToSrgb(const float x){
+	return x <= 0.0031308f ? 12.92f * x : 1.055f * std::pow(x, 1.0f / 2.4f) - 0.055f;
+}
+
+static unsigned char quantize(const float x){
+	return (unsigned char)(glm::clamp(x * 255.0f + 0.5f, 0.0f, 255.0f));
+}
+
+void TextureUtilities::generateMipmaps(const unsigned char * pixels, const uint32_t width, const uint32_t height, const bool normal, std::vector<std::vector<unsigned char>> & levels){
+	const uint32_t count = levelsCount(width, height);
+	levels.resize(count);
+	levels[0].assign(pixels, pixels + size_t(width) * height * 4);
+	// Levels are computed from the previous one at full precision, four floats per pixel.
+	std::vector<float> current(size_t(width) * height * 4);
+	for(size_t pid = 0; pid < size_t(width) * height; ++pid){
+		for(int c = 0; c < 3; ++c){
+			current[4 * pid + c] = normal ? float(pixels[4 * pid + c]) / 127.5f - 1.0f : srgbToLinear(pixels[4 * pid + c]);
+		}
+		current[4 * pid + 3] = float(pixels[4 * pid + 3]) / 255.0f;
+	}
+	std::vector<float> next;
+	uint32_t levelWidth = width;
+	uint32_t levelHeight = height;
+	for(uint32_t lid = 1; lid < count; ++lid){
+		const uint32_t halfWidth = max(1u, levelWidth / 2);
+		const uint32_t halfHeight = max(1u, levelHeight / 2);
+		next.resize(size_t(halfWidth) * halfHeight * 4);
+		levels[lid].resize(size_t(halfWidth) * halfHeight * 4);
+		ThreadUtilities::parallelFor(halfHeight, ThreadUtilities::threadCount(), [&](unsigned int, size_t begin, size_t end){
+			for(size_t y = begin; y < end; ++y){
+				// Odd or unit sizes reuse the last row/column.
+				const float * row0 = &current[size_t(min(uint32_t(2 * y), levelHeight - 1)) * levelWidth * 4];
+				const float * row1 = &current[size_t(min(uint32_t(2 * y + 1), levelHeight - 1)) * levelWidth * 4];
+				for(uint32_t x = 0; x < halfWidth; ++x){
+					const size_t x0 = size_t(min(2 * x, levelWidth - 1)) * 4;
+					const size_t x1 = size_t(min(2 * x + 1, levelWidth - 1)) * 4;
+					float * dst = &next[(y * halfWidth + x) * 4];
+#ifdef DRAGON_SSE
+					const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)), _mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+					_mm_storeu_ps(dst, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+					for(int c = 0; c < 4; ++c){
+						dst[c] = 0.25f * (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]);
+					}
+#endif
+					unsigned char * result = &levels[lid][(y * halfWidth + x) * 4];
+					if(normal){
+						// Average the vectors, not their encoding, and keep them unit length.
+						glm::vec3 n(dst[0], dst[1], dst[2]);
+						const float length = glm::length(n);
+						n = length > 0.0f ? n / length : glm::vec3(0.0f, 0.0f, 1.0f);
+						dst[0] = n.x; dst[1] = n.y; dst[2] = n.z;
+						for(int c = 0; c < 3; ++c){
+							result[c] = quantize(0.5f * dst[c] + 0.5f);
+						}
+					} else {
+						for(int c = 0; c < 3; ++c){
+							result[c] = quantize(linearToSrgb(dst[c]));
+						}
+					}
+					result[3] = quantize(dst[3]);
+				}
+			}
+		});
+		current.swap(next);
+		levelWidth = halfWidth;
+		levelHeight = halfHeight;
+	}
+}
+
+size_t TextureUtilities::encodedSize(const uint32_t width, const uint32_t height, const Encoding encoding){
+	if(encoding == RGBA8){
+		return size_t(width) * height * 4;
+	}
+	const size_t blocksCount = size_t(max(1u, (width + 3) / 4)) * max(1u, (height + 3) / 4);
+	return blocksCount * (encoding == BC1 ? 8 : 16);
+}
+
+void TextureUtilities::encode(const unsigned char * pixels, const uint32_t width, const uint32_t height, const Encoding encoding, unsigned char * blocks){
+	if(encoding == RGBA8){
+		memcpy(blocks, pixels, encodedSize(width, height, encoding));
+		return;
+	}
+	const uint32_t blocksWidth = max(1u, (width + 3) / 4);
+	const uint32_t blocksHeight = max(1u, (height + 3) / 4);
+	const size_t blockSize = encoding == BC1 ? 8 : 16;
+	ThreadUtilities::parallelFor(blocksHeight, ThreadUtilities::threadCount(), [&](unsigned int, size_t begin, size_t end){
+		unsigned char block[64];
+		unsigned char channel[16];
+		for(size_t by = begin; by < end; ++by){
+			for(uint32_t bx = 0; bx < blocksWidth; ++bx){
+				// Gather the block, replicating the edges of images smaller than a block.
+				for(uint32_t py = 0; py < 4; ++py){
+					const size_t y = min(size_t(4 * by + py), size_t(height - 1));
+					for(uint32_t px = 0; px < 4; ++px){
+						const size_t x = min(size_t(4 * bx + px), size_t(width - 1));
+						memcpy(&block[(py * 4 + px) * 4], &pixels[(y * width + x) * 4], 4);
+					}
+				}
+				unsigned char * result = blocks + (by * blocksWidth + bx) * blockSize;
+				if(encoding == BC1){
+					compressBC1Block(block, result);
+					continue;
+				}
+				// BC5: red then green, each as a BC4 block.
+				for(int c = 0; c < 2; ++c){
+					for(int pid = 0; pid < 16; ++pid){
+						channel[pid] = block[pid * 4 + c];
+					}
+					compressBC4Block(channel, result + 8 * c);
+				}
+			}
+		}
+	});
+}
+
+// 565 quantization, and expansion back to 8 bits as done by the hardware.
+static uint16_t packColor(const glm::vec3 & color){
+	const glm::vec3 c = glm::clamp(color, 0.0f, 255.0f);
+	const uint16_t r = uint16_t((c.r * 31.0f + 127.5f) / 255.0f);
+	const uint16_t g = uint16_t((c.g * 63.0f + 127.5f) / 255.0f);
+	const uint16_t b = uint16_t((c.b * 31.0f + 127.5f) / 255.0f);
+	return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static glm::vec3 unpackColor(const uint16_t color){
+	const int r = (color >> 11) & 31;
+	const int g = (color >> 5) & 63;
+	const int b = color & 31;
+	return glm::vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+void TextureUtilities::compressBC1Block(const unsigned char * block, unsigned char * result){
+	glm::vec3 colors[16];
+	glm::vec3 mean(0.0f);
+	for(int pid = 0; pid < 16; ++pid){
+		colors[pid] = glm::vec3(block[4 * pid], block[4 * pid + 1], block[4 * pid + 2]);
+		mean += colors[pid];
+	}
+	mean /= 16.0f;
+	// Principal axis of the colors, by power iteration on their covariance.
+	glm::mat3 covariance(0.0f);
+	for(int pid = 0; pid < 16; ++pid){
+		const glm::vec3 d = colors[pid] - mean;
+		covariance += glm::outerProduct(d, d);
+	}
+	glm::vec3 axis(1.0f);
+	for(int iteration = 0; iteration < 8; ++iteration){
+		axis = covariance * axis;
+		const float length = glm::length(axis);
+		if(length < 1e-6f){
+			break;
+		}
+		axis /= length;
+	}
+	// Endpoints: the colors the furthest apart along the axis.
+	int minId = 0;
+	int maxId = 0;
+	float minProj = glm::dot(colors[0], axis);
+	float maxProj = minProj;
+	for(int pid = 1; pid < 16; ++pid){
+		const float proj = glm::dot(colors[pid], axis);
+		if(proj < minProj){ minProj = proj; minId = pid; }
+		if(proj > maxProj){ maxProj = proj; maxId = pid; }
+	}
+	uint16_t color0 = packColor(colors[maxId]);
+	uint16_t color1 = packColor(colors[minId]);
+	// Four colors mode requires color0 > color1.
+	if(color0 < color1){
+		std::swap(color0, color1);
+	}
+	uint32_t indices = 0;
+	if(color0 != color1){
+		const glm::vec3 c0 = unpackColor(color0);
+		const glm::vec3 c1 = unpackColor(color1);
+		const glm::vec3 palette[4] = { c0, c1, (2.0f * c0 + c1) / 3.0f, (c0 + 2.0f * c1) / 3.0f };
+		for(int pid = 0; pid < 16; ++pid){
+			uint32_t best = 0;
+			float bestDistance = std::numeric_limits<float>::max();
+			for(uint32_t i = 0; i < 4; ++i){
+				const glm::vec3 d = colors[pid] - palette[i];
+				const float distance = glm::dot(d, d);
+				if(distance < bestDistance){
+					bestDistance = distance;
+					best = i;
+				}
+			}
+			indices |= best << (2 * pid);
+		}
+	}
+	// Little endian layout.
+	result[0] = uint8_t(color0 & 0xFF);
+	result[1] = uint8_t(color0 >> 8);
+	result[2] = uint8_t(color1 & 0xFF);
+	result[3] = uint8_t(color1 >> 8);
+	for(int i = 0; i < 4; ++i){
+		result[4 + i] = uint8_t((indices >> (8 * i)) & 0xFF);
+	}
+}
+
+void TextureUtilities::compressBC4Block(const unsigned char * values, unsigned char * result){
+	const unsigned char maxi = *std::max_element(values, values + 16);
+	const unsigned char mini = *std::min_element(values, values + 16);
+	// Eight values mode requires value0 > value1, a constant block only uses value0.
+	result[0] = maxi;
+	result[1] = mini;
+	uint64_t indices = 0;
+	if(maxi != mini){
+		float palette[8];
+		palette[0] = float(maxi);
+		palette[1] = float(mini);
+		for(int i = 2; i < 8; ++i){
+			palette[i] = (float(8 - i) * maxi + float(i - 1) * mini) / 7.0f;
+		}
+		for(int pid = 0; pid < 16; ++pid){
+			uint64_t best = 0;
+			float bestDistance = std::numeric_limits<float>::max();
+			for(uint64_t i = 0; i < 8; ++i){
+				const float distance = std::abs(float(values[pid]) - palette[i]);
+				if(distance < bestDistance){
+					bestDistance = distance;
+					best = i;
+				}
+			}
+			indices |= best << (3 * pid);
+		}
+	}
+	for(int i = 0; i < 6; ++i){
+		result[2 + i] = uint8_t((indices >> (8 * i)) & 0xFF);
+	}
+}
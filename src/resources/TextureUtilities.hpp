@@ -0,0 +1,39 @@
+#ifndef TextureUtilities_h
+#define TextureUtilities_h
+
+#include "../common.hpp"
+
+class TextureUtilities {
+
+public:
+
+	// Texture encodings: RGBA8 stores the pixels as is, BC1 the RGB channels of color maps (8 bytes per 4x4 block),
+	// BC5 the RG channels of normal maps, the third component being reconstructed (16 bytes per block).
+	enum Encoding {
+		RGBA8, BC1, BC5
+	};
+
+	/// Number of levels in the full mip chain of an image.
+	static uint32_t levelsCount(const uint32_t width, const uint32_t height);
+
+	/// Full mip chain of an RGBA8 image with a box filter, level 0 being a copy of the image.
+	/// Color maps are filtered in linear space, normal maps are renormalized.
+	static void generateMipmaps(const unsigned char * pixels, const uint32_t width, const uint32_t height, const bool normal, std::vector<std::vector<unsigned char>> & levels);
+
+	/// Size in bytes of an image of the given dimensions once encoded.
+	static size_t encodedSize(const uint32_t width, const uint32_t height, const Encoding encoding);
+
+	/// Encode RGBA8 pixels, blocks are compressed on ThreadUtilities::threadCount() threads.
+	static void encode(const unsigned char * pixels, const uint32_t width, const uint32_t height, const Encoding encoding, unsigned char * result);
+
+private:
+
+	/// Encode a 4x4 block of RGBA8 pixels, as two 565 endpoints and 2 bits indices.
+	static void compressBC1Block(const unsigned char * block, unsigned char * result);
+
+	/// Encode 16 values of a channel, as two 8 bits endpoints and 3 bits indices.
+	static void compressBC4Block(const unsigned char * values, unsigned char * result);
+
+};
+
+#endif